@@ -0,0 +1,78 @@
+#include "Arena.h"
+#include <algorithm>
+
+namespace
+{
+
+thread_local Arena *current_arena = nullptr;
+
+}
+
+Arena::Arena(std::size_t capacity)
+    : block(static_cast<char *>(::operator new(capacity))), size(capacity)
+{
+    overflow.reserve(16);
+}
+
+Arena::~Arena()
+{
+    reset();
+    ::operator delete(block);
+}
+
+void *Arena::allocate(std::size_t bytes, std::size_t alignment)
+{
+    std::size_t start = (offset + alignment - 1) / alignment * alignment;
+    if (start + bytes <= size)
+    {
+        offset = start + bytes;
+        return block + start;
+    }
+
+    // Blocks of operator new are aligned for any fundamental type.
+    void *p = ::operator new(bytes);
+    overflow.push_back(p);
+    overflow_size += bytes;
+    return p;
+}
+
+bool Arena::owns(const void *p) const
+{
+    auto c = static_cast<const char *>(p);
+    if (c >= block && c < block + size)
+        return true;
+    return std::find(overflow.begin(), overflow.end(), p) != overflow.end();
+}
+
+void Arena::reset()
+{
+    if (!overflow.empty())
+    {
+        std::size_t peak = used();
+        for (auto p : overflow)
+            ::operator delete(p);
+        overflow.clear();
+        overflow_size = 0;
+
+        ::operator delete(block);
+        size = std::max(2 * size, peak + peak / 2);
+        block = static_cast<char *>(::operator new(size));
+    }
+    offset = 0;
+}
+
+Arena *Arena::current()
+{
+    return current_arena;
+}
+
+Arena::Frame::Frame(Arena &arena) : arena(arena), previous(current_arena)
+{
+    current_arena = &arena;
+}
+
+Arena::Frame::~Frame()
+{
+    current_arena = previous;
+    arena.reset();
+}
@@ -0,0 +1,115 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+// Monotonic memory arena.
+//
+// Allocations bump a pointer in one block and are released all at once by
+// reset().  Requests that do not fit get blocks of their own, and the next
+// reset() grows the main block to the peak usage, so after the first frames
+// an arena that is reset once per frame does not allocate any more.
+class Arena
+{
+public:
+    explicit Arena(std::size_t capacity = 64 * 1024);
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    void *allocate(std::size_t size, std::size_t alignment);
+
+    // Check if p was allocated from the arena since the last reset.
+    bool owns(const void *p) const;
+
+    // Release all allocations, objects in the arena must be destroyed before.
+    void reset();
+
+    std::size_t capacity() const { return size; }
+    std::size_t used() const { return offset + overflow_size; }
+
+    // Arena used by ArenaAllocator on this thread, nullptr for the heap.
+    static Arena *current();
+
+    // Make an arena current for one frame and reset it when the frame ends.
+    // Objects declared after the frame are destroyed before the reset.
+    class Frame
+    {
+    public:
+        explicit Frame(Arena &arena);
+        ~Frame();
+
+        Frame(const Frame &) = delete;
+        Frame &operator=(const Frame &) = delete;
+
+    private:
+        Arena &arena;
+        Arena *previous;
+    };
+
+private:
+    char *block;
+    std::size_t size;
+    std::size_t offset = 0;
+    std::vector<void *> overflow;
+    std::size_t overflow_size = 0;
+};
+
+// Standard allocator on the current arena of the thread, used as the
+// AllocatorType of nlohmann::basic_json.  Without a current arena it falls
+// back to the heap.  Deallocation of arena memory does nothing, so the
+// containers must be destroyed while the arena they came from is current.
+template <typename T>
+struct ArenaAllocator
+{
+    typedef T value_type;
+
+    template <typename U>
+    struct rebind
+    {
+        typedef ArenaAllocator<U> other;
+    };
+
+    ArenaAllocator() = default;
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U> &) {}
+
+    T *allocate(std::size_t n)
+    {
+        if (Arena *arena = Arena::current())
+            return static_cast<T *>(arena->allocate(n * sizeof(T), alignof(T)));
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, std::size_t)
+    {
+        Arena *arena = Arena::current();
+        if (arena == nullptr || !arena->owns(p))
+            ::operator delete(p);
+    }
+
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&... args)
+    {
+        ::new (static_cast<void *>(p)) U(std::forward<Args>(args)...);
+    }
+
+    template <typename U>
+    void destroy(U *p)
+    {
+        p->~U();
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return true; }
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T> &, const ArenaAllocator<U> &) { return false; }
+
+#endif /* ARENA_H */
@@ -0,0 +1,171 @@
+#include "Config.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+
+void Config::parse(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg.size() < 3 || arg[0] != '-' || arg[1] != '-')
+        {
+            std::cerr << "Ignoring argument " << arg << std::endl;
+            continue;
+        }
+
+        // A flag without a value is a switch.
+        if (i + 1 < argc && std::string(argv[i + 1]).compare(0, 2, "--") != 0)
+            values[arg.substr(2)] = argv[++i];
+        else
+            values[arg.substr(2)] = "1";
+    }
+
+    if (has("config") && !load(get("config", "")))
+        std::cerr << "Failed to read " << get("config", "") << std::endl;
+}
+
+bool Config::load(const std::string &path)
+{
+    std::ifstream input(path);
+    if (!input)
+        return false;
+
+    std::string line;
+    while (std::getline(input, line))
+    {
+        line = line.substr(0, line.find('#'));
+        std::istringstream stream(line);
+        std::string key, value;
+        if (stream >> key >> value)
+            values.insert(std::make_pair(key, value));
+    }
+    return true;
+}
+
+bool Config::has(const std::string &key) const
+{
+    return values.count(key) != 0;
+}
+
+std::string Config::get(const std::string &key, const std::string &fallback) const
+{
+    auto it = values.find(key);
+    return it == values.end() ? fallback : it->second;
+}
+
+double Config::get(const std::string &key, double fallback) const
+{
+    auto it = values.find(key);
+    return it == values.end() ? fallback : std::strtod(it->second.c_str(), nullptr);
+}
+
+int Config::get(const std::string &key, int fallback) const
+{
+    auto it = values.find(key);
+    return it == values.end() ? fallback : std::atoi(it->second.c_str());
+}
+
+// Longest list of parse_list, far beyond any horizon.
+static const std::size_t max_list_size = 10000;
+
+std::vector<double> parse_list(const std::string &s)
+{
+    std::vector<double> result;
+    std::istringstream stream(s);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (item.empty())
+            continue;
+
+        const char *begin = item.c_str();
+        char *end = nullptr;
+        double value = std::strtod(begin, &end);
+        if (end == begin || !std::isfinite(value))
+            throw std::invalid_argument("Not a number in the list: " + item);
+        long count = 1;
+        if (*end == 'x')
+        {
+            begin = end + 1;
+            count = std::strtol(begin, &end, 10);
+            if (end == begin || count < 1)
+                throw std::invalid_argument("Not a positive count in the list: " + item);
+        }
+        if (*end != '\0')
+            throw std::invalid_argument("Malformed item in the list: " + item);
+        if (static_cast<unsigned long>(count) > max_list_size - result.size())
+            throw std::invalid_argument("Lists are limited to " + std::to_string(max_list_size) + " values");
+
+        result.insert(result.end(), count, value);
+    }
+    return result;
+}
+
+std::vector<std::size_t> make_blocks(const std::string &pattern, std::size_t n)
+{
+    std::vector<std::size_t> lengths;
+    for (auto value : parse_list(pattern))
+    {
+        if (!(value >= 1.) || value != std::floor(value))
+            throw std::invalid_argument("The actuator block lengths must be whole numbers of at least 1");
+        lengths.push_back(static_cast<std::size_t>(value));
+    }
+    if (lengths.empty())
+        lengths.push_back(1);
+
+    std::vector<std::size_t> blocks;
+    std::size_t covered = 0;
+    for (std::size_t i = 0; covered < n; ++i)
+    {
+        auto length = std::min(lengths[std::min(i, lengths.size() - 1)], n - covered);
+        blocks.push_back(length);
+        covered += length;
+    }
+    return blocks;
+}
+
+std::vector<std::string> split(const std::string &s, char separator)
+{
+    std::vector<std::string> result;
+    std::istringstream stream(s);
+    std::string item;
+    while (std::getline(stream, item, separator))
+    {
+        if (!item.empty())
+            result.push_back(item);
+    }
+    return result;
+}
+
+std::vector<Config> make_configs(const Config &config, const std::vector<std::string> &keys,
+                                 std::vector<std::string> &labels)
+{
+    std::vector<Config> configs(1, config);
+    labels.assign(1, std::string());
+    for (const auto &key : keys)
+    {
+        auto values = split(config.get(key, ""), ';');
+        if (values.empty())
+            continue;
+
+        std::vector<Config> product;
+        std::vector<std::string> product_labels;
+        for (std::size_t i = 0; i < configs.size(); ++i)
+        {
+            for (const auto &value : values)
+            {
+                product.push_back(configs[i]);
+                product.back().set(key, value);
+                product_labels.push_back(labels[i] + (values.size() > 1 ? key + "=" + value + " " : ""));
+            }
+        }
+        configs.swap(product);
+        labels.swap(product_labels);
+    }
+    return configs;
+}
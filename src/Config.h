@@ -0,0 +1,55 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <map>
+#include <string>
+#include <vector>
+
+// Run-time options of the controller and its tools.
+//
+// Options are given as `--key value` pairs on the command line or as
+// `key value` lines in the file given with `--config`, where `#` starts
+// a comment.  The command line takes precedence over the file.
+// Every tool reads only the keys it knows about.
+class Config
+{
+public:
+    void parse(int argc, char **argv);
+
+    // Read a configuration file, keys that are already set are kept.
+    bool load(const std::string &path);
+
+    void set(const std::string &key, const std::string &value) { values[key] = value; }
+
+    bool has(const std::string &key) const;
+
+    std::string get(const std::string &key, const std::string &fallback) const;
+    double get(const std::string &key, double fallback) const;
+    int get(const std::string &key, int fallback) const;
+
+private:
+    std::map<std::string, std::string> values;
+};
+
+// Parse a comma separated list of values where `value x count` repeats
+// a value, e.g. "1x4,2x4,4" is 1,1,1,1,2,2,2,2,4.  Throws
+// std::invalid_argument for malformed items and lists of over 10000 values.
+std::vector<double> parse_list(const std::string &s);
+
+// Split the horizon of n stages into actuator blocks according to a pattern
+// of block lengths.  The last length of the pattern is repeated until the
+// horizon is covered and the last block is clipped to fit, so "1" gives one
+// block per stage and "2" blocks of two stages.  Throws
+// std::invalid_argument for lengths that are not whole numbers of at least 1.
+std::vector<std::size_t> make_blocks(const std::string &pattern, std::size_t n);
+
+// Split a string at the separator, empty items are dropped.
+std::vector<std::string> split(const std::string &s, char separator);
+
+// Every combination of the values of the keys, which are semicolon
+// separated lists in config, e.g. `--model "kinematic;dynamic"`.  The labels
+// name the values of the keys that have more than one.
+std::vector<Config> make_configs(const Config &config, const std::vector<std::string> &keys,
+                                 std::vector<std::string> &labels);
+
+#endif /* CONFIG_H */
@@ -0,0 +1,208 @@
+#ifndef COST_H
+#define COST_H
+
+#include <cmath>
+#include <cstddef>
+#include "Config.h"
+
+// Cost terms of the objective.
+//
+// The objective is a sum over the stages of the horizon and every term only
+// looks at the variables of one stage.  Terms with a zero weight are skipped
+// while FG_eval runs, so CppAD does not tape or differentiate them.
+
+// Variables of one stage seen by the cost terms.
+template <typename T>
+struct StageVars
+{
+    std::size_t stage;  // index of the stage
+    std::size_t last;   // index of the last stage
+    const T *state;     // model states, the first six are x, y, psi, v, cte, epsi
+    const T *input;     // delta and a of the stage, nullptr at the last stage
+    const T *previous;  // delta and a of the previous block where a new block starts, nullptr otherwise
+    double ref_v;       // reference speed in m/s
+};
+
+// Indices of the states and actuations shared by all models.
+enum { cost_v = 3, cost_cte = 4, cost_epsi = 5 };
+enum { cost_delta = 0, cost_a = 1 };
+
+// Reference cross track error, orientation error and speed.
+struct TrackingCost
+{
+    double cte = 1.;
+    double epsi = 1.;
+    double v = 1e-1;
+
+    void load(const Config &config)
+    {
+        cte = config.get("cost.cte", cte);
+        epsi = config.get("cost.epsi", epsi);
+        v = config.get("cost.v", v);
+    }
+
+    template <typename T>
+    void add(T &f, const StageVars<T> &s) const
+    {
+        if (cte != 0.)
+            f += cte * s.state[cost_cte] * s.state[cost_cte];
+        if (epsi != 0.)
+            f += epsi * s.state[cost_epsi] * s.state[cost_epsi];
+        if (v != 0.)
+            f += v * (s.state[cost_v] - s.ref_v) * (s.state[cost_v] - s.ref_v);
+    }
+};
+
+// Magnitude of the actuations.
+struct EffortCost
+{
+    double delta = 100.;
+    double a = 5.;
+
+    void load(const Config &config)
+    {
+        delta = config.get("cost.delta", delta);
+        a = config.get("cost.a", a);
+    }
+
+    template <typename T>
+    void add(T &f, const StageVars<T> &s) const
+    {
+        if (s.input == nullptr)
+            return;
+        if (delta != 0.)
+            f += delta * s.input[cost_delta] * s.input[cost_delta];
+        if (a != 0.)
+            f += a * s.input[cost_a] * s.input[cost_a];
+    }
+};
+
+// Sudden changes of the actuations, which only happen between blocks.
+struct RateCost
+{
+    double delta = 5e6;
+    double a = 0.;
+
+    void load(const Config &config)
+    {
+        delta = config.get("cost.delta_rate", delta);
+        a = config.get("cost.a_rate", a);
+    }
+
+    template <typename T>
+    void add(T &f, const StageVars<T> &s) const
+    {
+        if (s.previous == nullptr)
+            return;
+        if (delta != 0.)
+            f += delta * (s.input[cost_delta] - s.previous[cost_delta]) * (s.input[cost_delta] - s.previous[cost_delta]);
+        if (a != 0.)
+            f += a * (s.input[cost_a] - s.previous[cost_a]) * (s.input[cost_a] - s.previous[cost_a]);
+    }
+};
+
+// Errors at the end of the horizon.
+struct TerminalCost
+{
+    double cte = 0.;
+    double epsi = 0.;
+
+    void load(const Config &config)
+    {
+        cte = config.get("cost.terminal_cte", cte);
+        epsi = config.get("cost.terminal_epsi", epsi);
+    }
+
+    template <typename T>
+    void add(T &f, const StageVars<T> &s) const
+    {
+        if (s.stage != s.last)
+            return;
+        if (cte != 0.)
+            f += cte * s.state[cost_cte] * s.state[cost_cte];
+        if (epsi != 0.)
+            f += epsi * s.state[cost_epsi] * s.state[cost_epsi];
+    }
+};
+
+// Soft bound of the cross track error, the squared excess over the limit
+// smoothed by a softplus with a sharpness of 10 per meter.
+struct SoftConstraintCost
+{
+    double cte = 0.;
+    double cte_limit = 2.;
+
+    void load(const Config &config)
+    {
+        cte = config.get("cost.soft_cte", cte);
+        cte_limit = config.get("cost.cte_limit", cte_limit);
+    }
+
+    template <typename T>
+    void add(T &f, const StageVars<T> &s) const
+    {
+        using std::exp;
+        using std::log;
+        if (cte == 0.)
+            return;
+        const double k = 10.;
+        T e2 = s.state[cost_cte] * s.state[cost_cte];
+        T excess = log(1. + exp(k * (e2 - cte_limit * cte_limit) / (2. * cte_limit))) / k;
+        f += cte * excess * excess;
+    }
+};
+
+// The objective as a composition of the cost terms.
+struct Cost
+{
+    TrackingCost tracking;
+    EffortCost effort;
+    RateCost rate;
+    TerminalCost terminal;
+    SoftConstraintCost soft;
+
+    // Read the weights `cost.*` from the configuration.
+    void load(const Config &config)
+    {
+        tracking.load(config);
+        effort.load(config);
+        rate.load(config);
+        terminal.load(config);
+        soft.load(config);
+    }
+
+    template <typename T>
+    void add(T &f, const StageVars<T> &s) const
+    {
+        tracking.add(f, s);
+        effort.add(f, s);
+        rate.add(f, s);
+        terminal.add(f, s);
+        soft.add(f, s);
+    }
+};
+
+// Reference speed from the mean squared curvature of the reference line,
+// a sigmoid from max down to max - span around the curvature threshold.
+struct SpeedProfile
+{
+    double max = 50.;         // in m/s
+    double span = 30.;        // in m/s
+    double gain = .5e5;
+    double curvature = 1.2e-4;
+
+    void load(const Config &config)
+    {
+        max = config.get("speed.max", max);
+        span = config.get("speed.span", span);
+        gain = config.get("speed.gain", gain);
+        curvature = config.get("speed.curvature", curvature);
+    }
+
+    double operator()(double curv2) const
+    {
+        return max - span / (1. + std::exp(-gain * (curv2 - curvature)));
+    }
+};
+
+#endif /* COST_H */
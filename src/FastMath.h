@@ -0,0 +1,199 @@
+#ifndef FASTMATH_H
+#define FASTMATH_H
+
+#include <cmath>
+#include <cstddef>
+#ifdef MPC_AVX2
+#include <immintrin.h>
+#endif
+
+// Packs of four doubles and polynomial sin, cos and atan on them for the
+// kernels that evaluate many stages at once.
+//
+// With the MPC_AVX2 build option a pack is an AVX2 register and the
+// polynomials use FMA, otherwise the same code runs on plain arrays that
+// the compiler may vectorize itself.  The polynomials are those of the
+// Cephes library: sin and cos reduce the argument by multiples of pi/2 in
+// three parts and are within 2.3e-16 of the exact values for |x| < 1e6,
+// atan reduces the argument below 0.66 and is within 2 ulp everywhere.
+namespace fast
+{
+
+#ifdef MPC_AVX2
+
+struct Pack
+{
+    enum { size = 4 };
+
+    Pack() {}
+    Pack(__m256d v) : v(v) {}
+    Pack(double x) : v(_mm256_set1_pd(x)) {}
+
+    static Pack load(const double *p) { return _mm256_loadu_pd(p); }
+    void store(double *p) const { _mm256_storeu_pd(p, v); }
+
+    __m256d v;
+};
+
+// Lanes where a comparison holds have all bits set.
+typedef Pack Mask;
+
+inline Pack operator+(Pack a, Pack b) { return _mm256_add_pd(a.v, b.v); }
+inline Pack operator-(Pack a, Pack b) { return _mm256_sub_pd(a.v, b.v); }
+inline Pack operator*(Pack a, Pack b) { return _mm256_mul_pd(a.v, b.v); }
+inline Pack operator/(Pack a, Pack b) { return _mm256_div_pd(a.v, b.v); }
+inline Pack operator-(Pack a) { return _mm256_xor_pd(a.v, _mm256_set1_pd(-0.)); }
+
+// a * b + c
+inline Pack fma(Pack a, Pack b, Pack c) { return _mm256_fmadd_pd(a.v, b.v, c.v); }
+
+inline Pack abs(Pack a) { return _mm256_andnot_pd(_mm256_set1_pd(-0.), a.v); }
+inline Pack floor(Pack a) { return _mm256_floor_pd(a.v); }
+inline Pack round(Pack a) { return _mm256_round_pd(a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+
+// Magnitude of a with the sign of b.
+inline Pack copysign(Pack a, Pack b)
+{
+    const __m256d sign = _mm256_set1_pd(-0.);
+    return _mm256_or_pd(_mm256_andnot_pd(sign, a.v), _mm256_and_pd(sign, b.v));
+}
+
+inline Mask operator>(Pack a, Pack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_GT_OQ); }
+inline Mask operator>=(Pack a, Pack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_GE_OQ); }
+inline Mask operator==(Pack a, Pack b) { return _mm256_cmp_pd(a.v, b.v, _CMP_EQ_OQ); }
+inline Mask operator|(Mask a, Mask b) { return _mm256_or_pd(a.v, b.v); }
+
+// a where mask is set, b elsewhere.
+inline Pack select(Mask mask, Pack a, Pack b) { return _mm256_blendv_pd(b.v, a.v, mask.v); }
+
+#else
+
+struct Pack
+{
+    enum { size = 4 };
+
+    Pack() {}
+    Pack(double x) { for (int i = 0; i < size; ++i) v[i] = x; }
+
+    static Pack load(const double *p) { Pack a; for (int i = 0; i < size; ++i) a.v[i] = p[i]; return a; }
+    void store(double *p) const { for (int i = 0; i < size; ++i) p[i] = v[i]; }
+
+    double v[size];
+};
+
+struct Mask
+{
+    bool v[Pack::size];
+};
+
+#define FAST_MATH_LANES(result, expression) \
+    for (int i = 0; i < Pack::size; ++i) \
+        result.v[i] = expression; \
+    return result
+
+inline Pack operator+(Pack a, Pack b) { Pack r; FAST_MATH_LANES(r, a.v[i] + b.v[i]); }
+inline Pack operator-(Pack a, Pack b) { Pack r; FAST_MATH_LANES(r, a.v[i] - b.v[i]); }
+inline Pack operator*(Pack a, Pack b) { Pack r; FAST_MATH_LANES(r, a.v[i] * b.v[i]); }
+inline Pack operator/(Pack a, Pack b) { Pack r; FAST_MATH_LANES(r, a.v[i] / b.v[i]); }
+inline Pack operator-(Pack a) { Pack r; FAST_MATH_LANES(r, -a.v[i]); }
+
+// a * b + c, rounded twice unlike the FMA of the AVX2 build.
+inline Pack fma(Pack a, Pack b, Pack c) { Pack r; FAST_MATH_LANES(r, a.v[i] * b.v[i] + c.v[i]); }
+
+inline Pack abs(Pack a) { Pack r; FAST_MATH_LANES(r, std::fabs(a.v[i])); }
+inline Pack floor(Pack a) { Pack r; FAST_MATH_LANES(r, std::floor(a.v[i])); }
+inline Pack round(Pack a) { Pack r; FAST_MATH_LANES(r, std::nearbyint(a.v[i])); }
+inline Pack copysign(Pack a, Pack b) { Pack r; FAST_MATH_LANES(r, std::copysign(a.v[i], b.v[i])); }
+
+inline Mask operator>(Pack a, Pack b) { Mask r; FAST_MATH_LANES(r, a.v[i] > b.v[i]); }
+inline Mask operator>=(Pack a, Pack b) { Mask r; FAST_MATH_LANES(r, a.v[i] >= b.v[i]); }
+inline Mask operator==(Pack a, Pack b) { Mask r; FAST_MATH_LANES(r, a.v[i] == b.v[i]); }
+inline Mask operator|(Mask a, Mask b) { Mask r; FAST_MATH_LANES(r, a.v[i] || b.v[i]); }
+
+inline Pack select(Mask mask, Pack a, Pack b) { Pack r; FAST_MATH_LANES(r, mask.v[i] ? a.v[i] : b.v[i]); }
+
+#undef FAST_MATH_LANES
+
+#endif
+
+// Sine and cosine of x at once.
+inline void sincos(Pack x, Pack &s, Pack &c)
+{
+    // x = j pi/2 + r with |r| <= pi/4, pi/2 split into three parts so that
+    // the products with j are exact.
+    const Pack j = round(x * Pack(2. / M_PI));
+    Pack r = fma(j, Pack(-1.57079625129699707031e+00), x);
+    r = fma(j, Pack(-7.54978941586159635336e-08), r);
+    r = fma(j, Pack(-5.39030285815811905290e-15), r);
+
+    const Pack z = r * r;
+    Pack ps = Pack(1.58962301576546568060e-10);
+    ps = fma(ps, z, Pack(-2.50507477628578072866e-08));
+    ps = fma(ps, z, Pack(2.75573136213857245213e-06));
+    ps = fma(ps, z, Pack(-1.98412698295895385996e-04));
+    ps = fma(ps, z, Pack(8.33333333332211858878e-03));
+    ps = fma(ps, z, Pack(-1.66666666666666307295e-01));
+    const Pack sin_r = fma(r * z, ps, r);
+
+    Pack pc = Pack(-1.13585365213876817300e-11);
+    pc = fma(pc, z, Pack(2.08757008419747316778e-09));
+    pc = fma(pc, z, Pack(-2.75573141792967388112e-07));
+    pc = fma(pc, z, Pack(2.48015872888517045348e-05));
+    pc = fma(pc, z, Pack(-1.38888888888730564116e-03));
+    pc = fma(pc, z, Pack(4.16666666666665929218e-02));
+    const Pack cos_r = fma(z * z, pc, fma(z, Pack(-0.5), Pack(1.)));
+
+    // Quadrant q of x in [0, 4).
+    const Pack q = j - Pack(4.) * floor(j * Pack(0.25));
+    const Mask odd = (q == Pack(1.)) | (q == Pack(3.));
+    const Pack sin_sign = select(q >= Pack(2.), Pack(-1.), Pack(1.));
+    const Pack cos_sign = select((q == Pack(1.)) | (q == Pack(2.)), Pack(-1.), Pack(1.));
+    s = select(odd, cos_r, sin_r) * sin_sign;
+    c = select(odd, sin_r, cos_r) * cos_sign;
+}
+
+inline Pack sin(Pack x)
+{
+    Pack s, c;
+    sincos(x, s, c);
+    return s;
+}
+
+inline Pack cos(Pack x)
+{
+    Pack s, c;
+    sincos(x, s, c);
+    return c;
+}
+
+inline Pack atan(Pack x)
+{
+    // Reduce |x| to [0, 0.66] with atan(x) = pi/2 - atan(1/x) above
+    // tan(3 pi/8) and atan(x) = pi/4 + atan((x - 1)/(x + 1)) above 0.66.
+    const double more_bits = 6.123233995736765886130e-17; // pi/2 - double(pi/2)
+    const Pack a = abs(x);
+    const Mask big = a > Pack(2.41421356237309504880);
+    const Mask mid = a > Pack(0.66);
+    const Pack r = select(big, Pack(-1.) / a, select(mid, (a - Pack(1.)) / (a + Pack(1.)), a));
+    const Pack offset = select(big, Pack(M_PI / 2.), select(mid, Pack(M_PI / 4.), Pack(0.)));
+    const Pack correction = select(big, Pack(more_bits), select(mid, Pack(0.5 * more_bits), Pack(0.)));
+
+    const Pack z = r * r;
+    Pack p = Pack(-8.750608600031904122785e-01);
+    p = fma(p, z, Pack(-1.615753718733365076637e+01));
+    p = fma(p, z, Pack(-7.500855792314704667340e+01));
+    p = fma(p, z, Pack(-1.228866684490136173410e+02));
+    p = fma(p, z, Pack(-6.485021904942025371773e+01));
+    Pack q = z + Pack(2.485846490142306297962e+01);
+    q = fma(q, z, Pack(1.650270098316988542046e+02));
+    q = fma(q, z, Pack(4.328810604912902668951e+02));
+    q = fma(q, z, Pack(4.853903996359136964868e+02));
+    q = fma(q, z, Pack(1.945506571482613964425e+02));
+
+    const Pack y = offset + (fma(r * z, p / q, r) + correction);
+    return copysign(y, x);
+}
+
+}
+
+#endif /* FASTMATH_H */
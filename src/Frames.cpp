@@ -0,0 +1,41 @@
+#include "Frames.h"
+#include <cmath>
+#include "RunLog.h"
+
+std::vector<Telemetry> make_frames(const Track &track, int count, double speed)
+{
+    std::vector<Telemetry> frames(count);
+    for (int k = 0; k < count; ++k)
+    {
+        double px, py, heading;
+        track.pose(track.length() * k / count, px, py, heading);
+
+        double offset = 1.0 * std::sin(0.7 * k);
+        auto &telemetry = frames[k];
+        telemetry.x = px - offset * std::sin(heading);
+        telemetry.y = py + offset * std::cos(heading);
+        telemetry.psi = heading + 0.05 * std::sin(1.3 * k);
+        telemetry.speed = speed * (1. + 0.6 * std::sin(0.01 * k)); // in mph
+        track.waypoints(telemetry.x, telemetry.y, 6, telemetry.ptsx, telemetry.ptsy);
+    }
+    return frames;
+}
+
+std::vector<Telemetry> load_frames(const Track &track, const std::string &path)
+{
+    std::vector<std::vector<double>> columns;
+    if (!read_run(path, columns))
+        return std::vector<Telemetry>();
+
+    std::vector<Telemetry> frames(columns[run_px].size());
+    for (std::size_t i = 0; i < frames.size(); ++i)
+    {
+        auto &telemetry = frames[i];
+        telemetry.x = columns[run_px][i];
+        telemetry.y = columns[run_py][i];
+        telemetry.psi = columns[run_psi][i];
+        telemetry.speed = columns[run_v][i] * 3600. / 1609.34; // in mph
+        track.waypoints(telemetry.x, telemetry.y, 6, telemetry.ptsx, telemetry.ptsy);
+    }
+    return frames;
+}
@@ -0,0 +1,22 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <string>
+#include <vector>
+#include "Telemetry.h"
+#include "Track.h"
+
+// Telemetry frames for the tools that replay them to the controller.
+
+// Synthetic frames along the track: the vehicle is placed on the center
+// line with a varying lateral offset, heading error and speed around the
+// mean speed in mph and receives the next six waypoints as from the
+// simulator.
+std::vector<Telemetry> make_frames(const Track &track, int count, double speed);
+
+// Frames at the poses of a run log of the controller, lines with the
+// position, orientation and speed in m/s as printed by mpc, e.g.
+// doc/data/first.data, or of a binary run log.  Other lines are skipped.
+std::vector<Telemetry> load_frames(const Track &track, const std::string &path);
+
+#endif /* FRAMES_H */
@@ -0,0 +1,74 @@
+#include "Latency.h"
+#include <algorithm>
+#include <cstdio>
+
+LatencyEstimator::LatencyEstimator(const Config &config)
+    : alpha(config.get("latency.alpha", 0.1)), transport(config.get("latency.transport", 0.)),
+      initial(config.get("latency", 0.1)), average(initial),
+      window_size(std::max(1, config.get("latency.window", 256)))
+{
+    window.reserve(window_size);
+}
+
+void LatencyEstimator::add(double processing)
+{
+    const double delay = processing + transport;
+    average += alpha * (delay - average);
+    total_delay += delay;
+    ++total;
+
+    if (window.size() < window_size)
+    {
+        window.push_back(delay);
+    }
+    else
+    {
+        window[next] = delay;
+        next = (next + 1) % window.size();
+    }
+}
+
+void LatencyEstimator::reset()
+{
+    average = initial;
+    window.clear();
+    next = 0;
+    total = 0;
+    total_delay = 0.;
+}
+
+double LatencyEstimator::quantile(double p) const
+{
+    if (window.empty())
+        return average;
+
+    std::vector<double> sorted(window);
+    auto position = sorted.begin() + static_cast<std::size_t>(p * (sorted.size() - 1));
+    std::nth_element(sorted.begin(), position, sorted.end());
+    return *position;
+}
+
+void format_metrics(const LatencyEstimator &estimator, double compensation, std::string &text)
+{
+    char line[128];
+    text = "# HELP mpc_latency_seconds Delay from a telemetry frame to its actuation.\n"
+           "# TYPE mpc_latency_seconds summary\n";
+    for (double p : {0.5, 0.9, 0.99})
+    {
+        std::snprintf(line, sizeof(line), "mpc_latency_seconds{quantile=\"%g\"} %.6f\n", p, estimator.quantile(p));
+        text += line;
+    }
+    std::snprintf(line, sizeof(line), "mpc_latency_seconds_sum %.6f\nmpc_latency_seconds_count %zu\n",
+                  estimator.sum(), estimator.count());
+    text += line;
+
+    text += "# HELP mpc_latency_estimate_seconds Moving average of the delay.\n"
+            "# TYPE mpc_latency_estimate_seconds gauge\n";
+    std::snprintf(line, sizeof(line), "mpc_latency_estimate_seconds %.6f\n", estimator.value());
+    text += line;
+
+    text += "# HELP mpc_latency_compensation_seconds Delay compensated by the controller.\n"
+            "# TYPE mpc_latency_compensation_seconds gauge\n";
+    std::snprintf(line, sizeof(line), "mpc_latency_compensation_seconds %.6f\n", compensation);
+    text += line;
+}
@@ -0,0 +1,55 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "Config.h"
+
+// Online estimate of the delay from a telemetry frame to the application of
+// its actuations.
+//
+// The server measures the time from the arrival of a frame to the reply
+// and adds the transport delay to the simulator, which it cannot observe.
+// The estimate is an exponentially weighted moving average seeded with the
+// configured latency, the quantiles come from a window of the last samples.
+class LatencyEstimator
+{
+public:
+    // Reads `latency` as the initial estimate, the weight `latency.alpha` of
+    // a new sample, the `latency.window` of the quantiles and the
+    // `latency.transport` delay in s.
+    LatencyEstimator(const Config &config = Config());
+
+    // Add the processing time of a frame in s.
+    void add(double processing);
+
+    // Drop the samples and start from the configured latency again.
+    void reset();
+
+    // Estimated delay in s.
+    double value() const { return average; }
+
+    // Quantile p in [0, 1] of the delays in the window, the estimate without samples.
+    double quantile(double p) const;
+
+    std::size_t count() const { return total; }
+    double sum() const { return total_delay; }
+
+private:
+    double alpha;
+    double transport;
+    double initial;
+    double average;
+    std::size_t window_size;    // number of delays in the quantiles
+    std::vector<double> window; // ring buffer of the last delays
+    std::size_t next = 0;
+    std::size_t total = 0;
+    double total_delay = 0.;
+};
+
+// Format the estimate and the latency used by the controller in the
+// Prometheus text exposition format.
+void format_metrics(const LatencyEstimator &estimator, double compensation, std::string &text);
+
+#endif /* LATENCY_H */
@@ -1,73 +1,115 @@
 #include "MPC.h"
+#include "Model.h"
 #include <cppad/cppad.hpp>
 #include <cppad/ipopt/solve.hpp>
+#include <coin/IpIpoptApplication.hpp>
 #include "Eigen-3.3/Eigen/Core"
+#include "StageNLP.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <stdexcept>
 
 using CppAD::AD;
 
-// Set the timestep length and duration
-size_t N = 40;
-double dt = 0.05;
+// Set the default timestep durations, 40 stages of 50 ms
+const char *default_dt = "0.05x39";
 
-// This value assumes the model presented in the classroom is used.
-//
-// It was obtained by measuring the radius formed by running the vehicle in the
-// simulator around in a circle with a constant steering angle and velocity on a
-// flat terrain.
-//
-// Lf was tuned until the the radius formed by the simulating the model
-// presented in the classroom matched the previous radius.
-//
-// This is the length from front to CoG that has a similar radius.
-const double Lf = 2.67;
+Layout::Layout(std::size_t n_states, const std::vector<double> &dt, const std::vector<std::size_t> &blocks)
+    : N(dt.size() + 1), n_states(n_states), dt(dt)
+{
+    if (dt.empty())
+        throw std::invalid_argument("The horizon needs at least one stage duration in dt");
+    for (double duration : dt)
+    {
+        if (!(duration > 0.))
+            throw std::invalid_argument("The stage durations in dt must be positive");
+    }
 
-double ref_v = 32; // in m/s
+    for (std::size_t i = 0; i < blocks.size(); ++i)
+    {
+        if (blocks[i] == 0)
+            throw std::invalid_argument("The actuator blocks must not be empty");
+        block.insert(block.end(), blocks[i], i);
+    }
+    if (block.size() != N - 1)
+        throw std::invalid_argument("The actuator blocks must cover the stages of dt");
+    n_blocks = block.back() + 1;
+
+    // The solver takes all the state variables and actuator
+    // variables in a singular vector. Thus, we should to establish
+    // when one variable starts and another ends to make our lifes easier.
+    x_start = 0;
+    y_start = x_start + N;
+    psi_start = y_start + N;
+    v_start = psi_start + N;
+    cte_start = v_start + N;
+    epsi_start = cte_start + N;
+    delta_start = n_states * N;
+    a_start = delta_start + n_blocks;
 
-// The solver takes all the state variables and actuator
-// variables in a singular vector. Thus, we should to establish
-// when one variable starts and another ends to make our lifes easier.
-size_t x_start = 0;
-size_t y_start = x_start + N;
-size_t psi_start = y_start + N;
-size_t v_start = psi_start + N;
-size_t cte_start = v_start + N;
-size_t epsi_start = cte_start + N;
-size_t delta_start = epsi_start + N;
-size_t a_start = delta_start + N - 1;
+    // Set the number of model variables (includes both states and inputs).
+    n_vars = N * n_states + n_blocks * 2;
 
+    // Set the number of constraints
+    n_constraints = N * n_states;
+}
 
+template <typename Model>
 class FG_eval
 {
 public:
     // Fitted polynomial coefficients
     Eigen::VectorXd coeffs;
-    FG_eval(Eigen::VectorXd coeffs) { this->coeffs = coeffs; }
+    const Layout &layout;
+    const Model &model;
+    Integrator integrator;
+    const Cost &cost;
+    double ref_v;
+    FG_eval(Eigen::VectorXd coeffs, const Layout &layout, const Model &model, Integrator integrator,
+            const Cost &cost, double ref_v)
+        : layout(layout), model(model), integrator(integrator), cost(cost), ref_v(ref_v) { this->coeffs = coeffs; }
 
     typedef CPPAD_TESTVECTOR(AD<double>) ADvector;
     void operator()(ADvector& fg, const ADvector& vars) {
+        const auto x_start = layout.x_start;
+        const auto delta_start = layout.delta_start;
+        const auto a_start = layout.a_start;
+        const auto N = layout.N;
+
         // fg a vector of constraints, x is a vector of constraints.
         fg[0] = 0;
 
-        // Reference State Cost
-        for (int i = 0; i < N; ++i)
-        {
-            fg[0] += 1 * CppAD::pow(vars[cte_start + i], 2);
-            fg[0] += 1 * CppAD::pow(vars[epsi_start + i], 2);
-            fg[0] += 1e-1 * CppAD::pow(vars[v_start+ i] - ref_v, 2);
-        }
-
-        // Minimize the actuator values
-        for (int i = 0; i < N - 1; ++i)
+        // Cost terms of every stage
+        const int n_states = Model::n_states;
+        for (std::size_t i = 0; i < N; ++i)
         {
-            fg[0] += 100 * CppAD::pow(vars[delta_start + i], 2);
-            fg[0] += 5 * CppAD::pow(vars[a_start], 2);
-        }
-
-        // Minimize the sudden change
-        for (int i = 0; i < N - 2; ++i)
-        {
-            fg[0] += 5000000 * CppAD::pow(vars[delta_start + i + 1] - vars[delta_start + i], 2);
-            fg[0] +=  0 * CppAD::pow(vars[a_start + i +1] - vars[a_start], 2);
+            AD<double> state[n_states], input[2], previous[2];
+            for (int k = 0; k < n_states; ++k)
+            {
+                state[k] = vars[x_start + k * N + i];
+            }
+
+            StageVars<AD<double>> stage{i, N - 1, state, nullptr, nullptr, ref_v};
+            if (i < N - 1)
+            {
+                input[0] = vars[delta_start + layout.block[i]];
+                input[1] = vars[a_start + layout.block[i]];
+                stage.input = input;
+            }
+
+            // The actuations are constant inside a block
+            if (0 < i && i < N - 1 && layout.block[i] != layout.block[i - 1])
+            {
+                previous[0] = vars[delta_start + layout.block[i - 1]];
+                previous[1] = vars[a_start + layout.block[i - 1]];
+                stage.previous = previous;
+            }
+
+            cost.add(fg[0], stage);
         }
 
         //
@@ -80,114 +122,87 @@ public:
         // We add 1 to each of the starting indices due to cost being located at
         // index 0 of `fg`.
         // This bumps up the position of all the other values.
-        fg[1 + x_start] = vars[x_start];
-        fg[1 + y_start] = vars[y_start];
-        fg[1 + psi_start] = vars[psi_start];
-        fg[1 + v_start] = vars[v_start];
-        fg[1 + cte_start] = vars[cte_start];
-        fg[1 + epsi_start] = vars[epsi_start];
+        for (int k = 0; k < n_states; ++k)
+        {
+            fg[1 + x_start + k * N] = vars[x_start + k * N];
+        }
 
         // The rest of the constraints
         for (int i = 0; i < N - 1; i++)
         {
-            // The state at time t.
-            AD<double> x1 = vars[x_start + i + 1];
-            AD<double> y1 = vars[y_start + i + 1];
-            AD<double> psi1 = vars[psi_start + i + 1];
-            AD<double> v1 = vars[v_start + i + 1];
-            AD<double> cte1 = vars[cte_start + i + 1];
-            AD<double> epsi1 = vars[epsi_start + i + 1];
-
-            // The state at time t.
-            AD<double> x0 = vars[x_start + i];
-            AD<double> y0 = vars[y_start + i];
-            AD<double> psi0 = vars[psi_start + i];
-            AD<double> v0 = vars[v_start + i];
-            AD<double> cte0 = vars[cte_start + i];
-            AD<double> epsi0 = vars[epsi_start + i];
+            // The state at time t and t+1, the states are stored in the
+            // order of the model with N values each.
+            AD<double> s0[n_states], s1[n_states], predicted[n_states];
+            for (int k = 0; k < n_states; ++k)
+            {
+                s0[k] = vars[x_start + k * N + i];
+                s1[k] = vars[x_start + k * N + i + 1];
+            }
 
             // Only consider the actuation at time t.
-            AD<double> delta0 = vars[delta_start + i];
-            AD<double> a0 = vars[a_start + i];
+            AD<double> u0[Model::n_inputs];
+            u0[Model::delta] = vars[delta_start + layout.block[i]];
+            u0[Model::a] = vars[a_start + layout.block[i]];
 
-            AD<double> f0 = coeffs[0] + coeffs[1] * x0 + coeffs[2] * x0 * x0 + coeffs[3] * x0 * x0 * x0;
-            AD<double> psides0 = CppAD::atan(coeffs[1] + 2 * coeffs[2] * x0 + 3 * coeffs[3] * x0 * x0);
-
-            // Here's `x` to get you started.
-            // The idea here is to constraint this value to be 0.
-            //
-            // Recall the equations for the model:
+            // Recall the equations for the kinematic model, with the Euler integrator:
             // x_[t+1] = x[t] + v[t] * cos(psi[t]) * dt
             // y_[t+1] = y[t] + v[t] * sin(psi[t]) * dt
             // psi_[t+1] = psi[t] + v[t] / Lf * delta[t] * dt
             // v_[t+1] = v[t] + a[t] * dt
             // cte[t+1] = f(x[t]) - y[t] + v[t] * sin(epsi[t]) * dt
             // epsi[t+1] = psi[t] - psides[t] + v[t] * delta[t] / Lf * dt
-            // NOTE: The use of `AD<double>` and use of `CppAD`!
-            // This is also CppAD can compute derivatives and pass
-            // these to the solver.
-
-            // TODO: Setup the rest of the model constraints
-            fg[2 + x_start + i] = x1 - (x0 + v0 * CppAD::cos(psi0) * dt);
-            fg[2 + y_start + i] = y1 - (y0 + v0 * CppAD::sin(psi0) * dt);
-            fg[2 + psi_start + i] = psi1 - (psi0 + v0 * delta0 / Lf * dt);
-            fg[2 + v_start + i] = v1 - (v0 + a0 * dt);
-            fg[2 + cte_start + i] = cte1 - ((f0 - y0) + (v0 * CppAD::sin(epsi0) * dt));
-            fg[2 + epsi_start + i] = epsi1 - ((psi0 - psides0) + v0 * delta0 / Lf * dt);
+            // The higher order integrators evaluate the same derivatives
+            // inside the stage, CppAD differentiates whatever is taped.
+            transition(model, integrator, coeffs, s0, u0, layout.dt[i], predicted);
+
+            for (int k = 0; k < n_states; ++k)
+            {
+                fg[2 + x_start + k * N + i] = s1[k] - predicted[k];
+            }
         }
     }
 };
 
+// Solver buffers and evaluators allocated once and reused by every Solve.
 //
-// MPC class definition implementation.
-//
-MPC::MPC() {
-    const auto latency = 0.1; // in seconds
-    latency_position = static_cast<std::size_t>(latency / dt);
-    latency_offset = latency / dt - latency_position;
-}
-MPC::~MPC() {}
-
-std::tuple<double, double, std::vector<double>, std::vector<double>, double, double>
-MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs, double minx, double maxx)
+// The bounds of the variables never change and the constraint bounds only
+// change for the initial state, so they are filled here once.
+struct MPC::Workspace
 {
-    bool ok = true;
     typedef CPPAD_TESTVECTOR(double) Dvector;
 
-    double x = state[0];
-    double y = state[1];
-    double psi = state[2];
-    double v = state[3];
-    double cte = state[4];
-    double epsi = state[5];
+    Workspace(const MPC &mpc, const Config &config);
 
-    // Set the number of model variables (includes both states and inputs).
-    size_t n_vars = N * 6 + (N - 1) * 2;
-
-    // Set the number of constraints
-    size_t n_constraints = N * 6;
+    // Solve with the StageNLP of the model and convert its result to the
+    // solution of CppAD, return the number of iterations.
+    template <typename Model>
+    int solve_stages(StageNLP<Model> &nlp, const Eigen::VectorXd &coeffs, double ref_v);
 
-    // Initial value of the independent variables.
-    // SHOULD BE 0 besides initial state.
-    Dvector vars(n_vars);
-    for (std::size_t i = 0; i < n_vars; ++i)
-    {
-        vars[i] = 0;
-    }
-
-    // Set the initial variable values
-    vars[x_start] = x;
-    vars[y_start] = y;
-    vars[psi_start] = psi;
-    vars[v_start] = v;
-    vars[cte_start] = cte;
-    vars[epsi_start] = epsi;
+    Dvector vars;
+    Dvector vars_lowerbound, vars_upperbound;
+    Dvector constraints_lowerbound, constraints_upperbound;
+    std::string options;
+    CppAD::ipopt::solve_result<Dvector> solution;
+    FG_eval<KinematicModel> kinematic_eval;
+    FG_eval<DynamicModel> dynamic_eval;
+
+    // Only created for the autodiff backend, the pool with backend.threads.
+    std::unique_ptr<ThreadPool> pool;
+    Ipopt::SmartPtr<Ipopt::IpoptApplication> app;
+    Ipopt::SmartPtr<StageNLP<KinematicModel>> kinematic_nlp;
+    Ipopt::SmartPtr<StageNLP<DynamicModel>> dynamic_nlp;
+};
 
-    Dvector vars_lowerbound(n_vars);
-    Dvector vars_upperbound(n_vars);
+MPC::Workspace::Workspace(const MPC &mpc, const Config &config)
+    : vars(mpc.layout.n_vars), vars_lowerbound(mpc.layout.n_vars), vars_upperbound(mpc.layout.n_vars),
+      constraints_lowerbound(mpc.layout.n_constraints), constraints_upperbound(mpc.layout.n_constraints),
+      kinematic_eval(Eigen::VectorXd::Zero(4), mpc.layout, mpc.kinematic_model, mpc.integrator, mpc.cost, 0.),
+      dynamic_eval(Eigen::VectorXd::Zero(4), mpc.layout, mpc.dynamic_model, mpc.integrator, mpc.cost, 0.)
+{
+    const auto &layout = mpc.layout;
 
     // Set lower and upper limits for variables.
-    for (std::size_t i = 0; i < delta_start; i++)
+    for (std::size_t i = 0; i < layout.delta_start; i++)
     {
         vars_lowerbound[i] = -1.0e19;
         vars_upperbound[i] = +1.0e19;
@@ -196,71 +211,31 @@ MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs, double minx, double ma
     // The upper and lower limits of delta are set to -25 and 25
     // degrees (values in radians).
     // NOTE: Feel free to change this to something else.
-    for (std::size_t i = delta_start; i < delta_start + N - 1; ++i)
+    for (std::size_t i = layout.delta_start; i < layout.delta_start + layout.n_blocks; ++i)
     {
         vars_lowerbound[i] = -deg2rad(25);
         vars_upperbound[i] = +deg2rad(25);
     }
 
     // Acceleration/deceleration upper and lower limits.
-    auto poly = [&coeffs](double x) { return coeffs[0] + coeffs[1] * x + coeffs[2] * x * x + coeffs[3] * x * x * x; };
-    std:size_t ncross = 0, nsample = 1000;
-    double prevy = poly(0);
-    for (std::size_t i = 1; i < nsample; ++i)
-    {
-        double y = maxx * i / nsample;
-        ncross += (prevy * y <= 0.);
-        prevy = y;
-    }
-
-    for (std::size_t i = a_start; i < a_start + N - 1; ++i)
+    for (std::size_t i = layout.a_start; i < layout.a_start + layout.n_blocks; ++i)
     {
         vars_lowerbound[i] = -1.0;
-        vars_upperbound[i] = +1.0; // / (3 * ncross + 1);
+        vars_upperbound[i] = +1.0;
     }
 
     // Lower and upper limits for the constraints
     // Should be 0 besides initial state.
-    Dvector constraints_lowerbound(n_constraints);
-    Dvector constraints_upperbound(n_constraints);
-    for (std::size_t i = 0; i < n_constraints; ++i)
+    for (std::size_t i = 0; i < layout.n_constraints; ++i)
     {
         constraints_lowerbound[i] = 0;
         constraints_upperbound[i] = 0;
     }
 
-    constraints_lowerbound[x_start] = x;
-    constraints_lowerbound[y_start] = y;
-    constraints_lowerbound[psi_start] = psi;
-    constraints_lowerbound[v_start] = v;
-    constraints_lowerbound[cte_start] = cte;
-    constraints_lowerbound[epsi_start] = epsi;
-
-    constraints_upperbound[x_start] = x;
-    constraints_upperbound[y_start] = y;
-    constraints_upperbound[psi_start] = psi;
-    constraints_upperbound[v_start] = v;
-    constraints_upperbound[cte_start] = cte;
-    constraints_upperbound[epsi_start] = epsi;
-
-    auto curv = [&coeffs](double x) { return (2. * coeffs[2] + 6. * coeffs[3] * x) / pow(pow(coeffs[1] + 2. * coeffs[2] * x + 3. * coeffs[3] * x * x, 2.) + 1., 1.5); };
-    double curv2 = 0.;
-    for (double x = minx, dx = (maxx - minx) / 1000; x <= maxx; x += dx)
-    {
-        curv2 += pow(curv(x), 2.) * dx;
-    }
-
-    curv2 /= (maxx - minx);
-    ref_v = 50. - 30. / (1. + exp(-.5e5*(curv2-1.2e-4)));
-
-    // object that computes objective and constraints
-    FG_eval fg_eval(coeffs);
-
     //
     // NOTE: You don't have to worry about these options
     //
     // options for IPOPT solver
-    std::string options;
 
     // Uncomment this if you'd like more print information
     options += "Integer print_level  0\n";
@@ -274,56 +249,496 @@ MPC::Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs, double minx, double ma
     // NOTE: Currently the solver has a maximum time limit of 0.5 seconds.
     // Change this as you see fit.
     options += "Numeric max_cpu_time          0.5\n";
+    const std::string linear_solver = config.get("ipopt.linear_solver", "");
+    if (!linear_solver.empty())
+        options += "String  linear_solver  " + linear_solver + "\n";
+
+    if (mpc.backend != Backend::autodiff)
+        return;
+
+    // The same options for the application, the stages do not provide
+    // second derivatives.
+    app = IpoptApplicationFactory();
+    app->Options()->SetIntegerValue("print_level", 0);
+    app->Options()->SetStringValue("sb", "yes");
+    app->Options()->SetNumericValue("max_cpu_time", 0.5);
+    app->Options()->SetStringValue("hessian_approximation", "limited-memory");
+    if (!linear_solver.empty())
+        app->Options()->SetStringValue("linear_solver", linear_solver);
+    app->Initialize();
+
+    kinematic_nlp = new StageNLP<KinematicModel>(layout, mpc.kinematic_model, mpc.integrator, mpc.cost);
+    dynamic_nlp = new StageNLP<DynamicModel>(layout, mpc.dynamic_model, mpc.integrator, mpc.cost);
+    kinematic_nlp->vectorize = config.get("backend.vectorize", 1) != 0;
+
+    const int threads = config.get("backend.threads", 1);
+    if (threads != 1)
+    {
+        pool.reset(new ThreadPool(std::max(0, threads)));
+        kinematic_nlp->pool = dynamic_nlp->pool = pool.get();
+    }
+}
 
-    // place to return solution
-    CppAD::ipopt::solve_result<Dvector> solution;
+template <typename Model>
+int MPC::Workspace::solve_stages(StageNLP<Model> &nlp, const Eigen::VectorXd &coeffs, double ref_v)
+{
+    typedef CppAD::ipopt::solve_result<Dvector> Result;
+
+    nlp.coeffs = coeffs;
+    nlp.ref_v = ref_v;
+    nlp.start = &vars[0];
+    nlp.vars_lowerbound = &vars_lowerbound[0];
+    nlp.vars_upperbound = &vars_upperbound[0];
+    nlp.constraints_lowerbound = &constraints_lowerbound[0];
+    nlp.constraints_upperbound = &constraints_upperbound[0];
+
+    // Ipopt skips finalize_solution on some errors, so nothing of the last
+    // solve may be left over.
+    nlp.status = Ipopt::INTERNAL_ERROR;
+    nlp.solution.clear();
+
+    Ipopt::SmartPtr<Ipopt::TNLP> problem(&nlp);
+    const Ipopt::ApplicationReturnStatus status = app->OptimizeTNLP(problem);
+    if (status != Ipopt::Solve_Succeeded && status != Ipopt::Solved_To_Acceptable_Level &&
+        (nlp.status == Ipopt::SUCCESS || nlp.status == Ipopt::STOP_AT_ACCEPTABLE_POINT))
+        nlp.status = Ipopt::INTERNAL_ERROR;
+
+    switch (nlp.status)
+    {
+    case Ipopt::SUCCESS:
+        solution.status = Result::success;
+        break;
+    case Ipopt::MAXITER_EXCEEDED:
+        solution.status = Result::maxiter_exceeded;
+        break;
+    case Ipopt::STOP_AT_ACCEPTABLE_POINT:
+        solution.status = Result::stop_at_acceptable_point;
+        break;
+    case Ipopt::LOCAL_INFEASIBILITY:
+        solution.status = Result::local_infeasibility;
+        break;
+    default:
+        solution.status = Result::unknown;
+        break;
+    }
+    solution.x.resize(nlp.solution.size());
+    for (std::size_t i = 0; i < nlp.solution.size(); ++i)
+        solution.x[i] = nlp.solution[i];
+    solution.obj_value = nlp.objective;
 
-    // solve the problem
-    CppAD::ipopt::solve<Dvector, FG_eval>(options, vars, vars_lowerbound, vars_upperbound, constraints_lowerbound,
-                                          constraints_upperbound, fg_eval, solution);
+    auto statistics = app->Statistics();
+    return IsValid(statistics) ? statistics->IterationCount() : -1;
+}
 
-    // Check some of the solution values
-    ok &= solution.status == CppAD::ipopt::solve_result<Dvector>::success;
-    if (!ok)
-        return {0., 0., std::vector<double>(), std::vector<double>(), std::numeric_limits<double>::quiet_NaN(), ref_v};
-
-    auto curv_xy = [&solution](int i) {
-           auto dx = (solution.x[x_start + i + 1] - solution.x[x_start + i - 1]) / (2. * dt);
-           auto dy = (solution.x[y_start + i + 1] - solution.x[y_start + i - 1]) / (2. * dt);
-           auto d2x = (solution.x[x_start + i + 1] - 2. * solution.x[x_start + i] +  solution.x[x_start + i - 1]) / (dt * dt);
-           auto d2y = (solution.x[y_start + i + 1] - 2. * solution.x[y_start + i] +  solution.x[y_start + i - 1]) / (dt * dt);
-           return (dx * d2y - dy * d2x) / pow(dx * dx + dy * dy, 1.5);
-    };
-    double prev_curv = pow(curv_xy(1), 2.);
-    double curv2_xy = prev_curv * dt;
-    for (int i = 2; i < N - 1; ++i)
+namespace
+{
+
+std::atomic<bool> parallel_solves(false);
+thread_local std::size_t solver_thread = 0;
+
+// Numbers that reserve_solver_thread hands out.
+std::mutex reserve_mutex;
+std::vector<std::size_t> free_solver_threads;
+
+bool in_parallel()
+{
+    return parallel_solves;
+}
+
+std::size_t thread_number()
+{
+    return solver_thread;
+}
+
+}
+
+void setup_parallel_solves(std::size_t threads)
+{
+    // All numbers CppAD supports, those above threads are reserved.
+    CppAD::thread_alloc::parallel_setup(CPPAD_MAX_NUM_THREADS, in_parallel, thread_number);
+    CppAD::parallel_ad<double>();
+    free_solver_threads.clear();
+    for (std::size_t number = CPPAD_MAX_NUM_THREADS; number-- > threads;)
+        free_solver_threads.push_back(number);
+    parallel_solves = true;
+}
+
+void set_solver_thread(std::size_t number)
+{
+    solver_thread = number;
+}
+
+bool parallel_solves_enabled()
+{
+    return parallel_solves;
+}
+
+std::size_t reserve_solver_thread()
+{
+    if (!parallel_solves)
+        return 0;
+    std::lock_guard<std::mutex> lock(reserve_mutex);
+    if (free_solver_threads.empty())
+        throw std::runtime_error("All CppAD thread numbers are taken");
+    const std::size_t number = free_solver_threads.back();
+    free_solver_threads.pop_back();
+    return number;
+}
+
+void release_solver_thread(std::size_t number)
+{
+    if (!parallel_solves)
+        return;
+    std::lock_guard<std::mutex> lock(reserve_mutex);
+    free_solver_threads.push_back(number);
+}
+
+bool check_options(const Config &config)
+{
+    try
     {
-        double curr_curv = pow(curv_xy(i), 2.);
-        curv2_xy += (curr_curv  + prev_curv) * dt / 2.;
-        prev_curv = curr_curv;
+        MPC mpc(config);
     }
-    curv2_xy += prev_curv * dt;
+    catch (const std::invalid_argument &e)
+    {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+    return true;
+}
 
-    curv2_xy /= (N * dt);
-    // ref_v = 54. - 28. / (1. + exp(-1e5*(curv2_xy-1.2e-4)));
+bool thread_safe_linear_solver(const Config &config)
+{
+    const std::string solver = config.get("ipopt.linear_solver", "");
+    return solver == "ma27" || solver == "ma57" || solver == "ma77" || solver == "ma86" || solver == "ma97";
+}
 
+LatencyMode make_latency_mode(const std::string &name)
+{
+    return name == "predict" ? LatencyMode::predict : LatencyMode::interpolate;
+}
 
-    // Cost
-    auto cost = solution.obj_value;
-    std::cerr << "Cost " << cost << " " << solution.x[delta_start] << " " << solution.x[a_start]
-              << " " << maxx << " " << ncross << " " << "curvature " << curv2 << " vs " << curv2_xy << "\n";
+Backend make_backend(const std::string &name)
+{
+    return name == "autodiff" ? Backend::autodiff : Backend::cppad;
+}
 
-    std::vector<double> mpc_x_vals, mpc_y_vals;
+void CommandHistory::push(double time, double delta, double a)
+{
+    commands[next] = Command{time, delta, a};
+    next = (next + 1) % commands.size();
+    count = std::min(count + 1, commands.size());
+}
+
+bool CommandHistory::active(double time, double latency, double &delta, double &a) const
+{
+    // The newest command that has been applied.
+    for (std::size_t i = 1; i <= count; ++i)
+    {
+        const auto &command = commands[(next + commands.size() - i) % commands.size()];
+        if (command.time + latency <= time)
+        {
+            delta = command.delta;
+            a = command.a;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Advance the state s over the latency with the commands in flight, in
+// steps of about 5 ms.  Without a known command the vehicle keeps the last
+// steering angle and does not accelerate.
+template <typename Model>
+static void predict(const Model &model, const Eigen::VectorXd &coeffs, const CommandHistory &history,
+                    double now, double latency, double last_delta, double *s)
+{
+    const int steps = static_cast<int>(std::ceil(latency / 5e-3));
+    const double h = latency / steps;
+    double u[2], s1[Model::n_states];
+    for (int i = 0; i < steps; ++i)
+    {
+        if (!history.active(now + (i + 0.5) * h, latency, u[Model::delta], u[Model::a]))
+        {
+            u[Model::delta] = last_delta;
+            u[Model::a] = 0.;
+        }
+        transition(model, Integrator::rk4, coeffs, s, u, h, s1);
+        for (int k = 0; k < Model::n_states; ++k)
+            s[k] = s1[k];
+    }
+}
+
+// Outcome of a solve of CppAD or of solve_stages.
+static PlanStatus plan_status(CppAD::ipopt::solve_result<CPPAD_TESTVECTOR(double)>::status_type status)
+{
+    typedef CppAD::ipopt::solve_result<CPPAD_TESTVECTOR(double)> Result;
+    switch (status)
+    {
+    case Result::success:
+        return PlanStatus::success;
+    case Result::maxiter_exceeded:
+        return PlanStatus::max_iterations;
+    case Result::stop_at_acceptable_point:
+        return PlanStatus::acceptable;
+    case Result::local_infeasibility:
+        return PlanStatus::infeasible;
+    default:
+        return PlanStatus::failed;
+    }
+}
+
+//
+// MPC class definition implementation.
+//
+static Layout make_layout(const Config &config)
+{
+    std::size_t n_states = KinematicModel::n_states;
+    if (make_model_type(config.get("model", "kinematic")) == ModelType::dynamic)
+        n_states = DynamicModel::n_states;
+    auto dt = parse_list(config.get("dt", default_dt));
+    if (dt.size() + 1 > max_stages)
+    {
+        std::cerr << "Horizon is limited to " << max_stages << " stages" << std::endl;
+        dt.resize(max_stages - 1);
+    }
+    return Layout(n_states, dt, make_blocks(config.get("blocks", "1"), dt.size()));
+}
+
+MPC::MPC(const Config &config)
+    : layout(make_layout(config)), model_type(make_model_type(config.get("model", "kinematic"))),
+      integrator(make_integrator(config.get("integrator", "euler"))),
+      backend(make_backend(config.get("backend", "cppad"))), last_delta(0.), config(config)
+{
+    cost.load(config);
+    speed_profile.load(config);
+
+    latency_mode = make_latency_mode(config.get("latency.mode", "interpolate"));
+    clock = [] { return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count(); };
+
+    set_latency(config.get("latency", 0.1)); // in seconds
+
+    workspace.reset(new Workspace(*this, config));
+}
+MPC::~MPC() {}
+
+std::size_t MPC::SolveBatch(const std::vector<Problem> &problems, std::vector<Plan> &plans, ThreadPool &pool)
+{
+    plans.resize(problems.size());
+    if (batch_controllers.size() < pool.size())
+        batch_controllers.resize(pool.size());
+
+    // A few chunks per worker, so the workers that finish early steal the
+    // chunks of slow ones.
+    const std::size_t chunk = std::max<std::size_t>(1, problems.size() / (4 * pool.size()));
+    const std::size_t chunks = (problems.size() + chunk - 1) / chunk;
+    std::atomic<std::size_t> failures(0);
+    pool.run(chunks, [&](std::size_t c, std::size_t worker) {
+            set_solver_thread(worker);
+            auto &mpc = batch_controllers[worker];
+            if (!mpc)
+                mpc.reset(new MPC(config));
+            if (mpc->latency != latency)
+                mpc->set_latency(latency);
+
+            for (std::size_t i = c * chunk; i < std::min(problems.size(), (c + 1) * chunk); ++i)
+            {
+                const auto &problem = problems[i];
+                mpc->last_delta = problem.last_delta;
+                mpc->history = CommandHistory();
+                if (!mpc->Solve(problem.state, problem.coeffs, problem.minx, problem.maxx, plans[i]))
+                    ++failures;
+            }
+        });
+    return failures;
+}
+
+void MPC::set_latency(double value)
+{
+    latency = std::max(0., value);
+
+    // Find the stage during which the actuations get applied.
+    double t = 0.;
+    // The actuations are interpolated towards those of the next stage, so
+    // the last stage is only reached with an offset of 1.
+    latency_position = 0;
+    while (latency_position + 2 < layout.dt.size() && t + layout.dt[latency_position] <= latency)
+    {
+        t += layout.dt[latency_position++];
+    }
+    latency_offset = std::min(1., (latency - t) / layout.dt[latency_position]);
+}
+
+void MPC::reset()
+{
+    last_delta = 0.;
+    history = CommandHistory();
+    set_latency(config.get("latency", 0.1));
+}
+
+bool MPC::Solve(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, double minx, double maxx, Plan &plan,
+                const Plan *guess)
+{
+    auto solve_start = std::chrono::steady_clock::now();
+    typedef Workspace::Dvector Dvector;
+    auto &vars = workspace->vars;
+    auto &constraints_lowerbound = workspace->constraints_lowerbound;
+    auto &constraints_upperbound = workspace->constraints_upperbound;
+    auto &solution = workspace->solution;
+
+    // Extend the state for the model.
+    double s0[DynamicModel::n_states];
+    for (int k = 0; k < KinematicModel::n_states; ++k)
+    {
+        s0[k] = state[k];
+    }
+    if (model_type == ModelType::dynamic)
+        dynamic_model.extend(s0, last_delta);
+
+    // Start from the state when the actuations will be applied.
+    const double now = clock();
+    if (latency_mode == LatencyMode::predict && latency > 0.)
+    {
+        if (model_type == ModelType::dynamic)
+            predict(dynamic_model, coeffs, history, now, latency, last_delta, s0);
+        else
+            predict(kinematic_model, coeffs, history, now, latency, last_delta, s0);
+    }
+
+    const auto x_start = layout.x_start;
+    const auto delta_start = layout.delta_start;
+    const auto a_start = layout.a_start;
+    const auto n_vars = layout.n_vars;
+    const auto N = layout.N;
+    const auto &dt = layout.dt;
+
+    // Initial value of the independent variables.
+    // SHOULD BE 0 besides initial state.
+    for (std::size_t i = 0; i < n_vars; ++i)
+    {
+        vars[i] = 0;
+    }
+
+    // Or from the solution of a plan with the same layout.
+    if (guess && guess->ok() && guess->N == N && guess->n_states == layout.n_states)
+    {
+        for (std::size_t k = 0; k < layout.n_states; ++k)
+        {
+            for (std::size_t i = 1; i < N; ++i)
+                vars[x_start + k * N + i] = guess->states[k][i];
+        }
+        for (std::size_t i = N - 1; i-- > 0;)
+        {
+            vars[delta_start + layout.block[i]] = guess->inputs[0][i];
+            vars[a_start + layout.block[i]] = guess->inputs[1][i];
+        }
+    }
+
+    // Set the initial variable values and fix them by the constraints.
+    for (std::size_t k = 0; k < layout.n_states; ++k)
+    {
+        vars[x_start + k * N] = s0[k];
+        constraints_lowerbound[x_start + k * N] = s0[k];
+        constraints_upperbound[x_start + k * N] = s0[k];
+    }
+
+    // Mean squared curvature of the reference line sets the reference speed.
+    auto curv = [&coeffs](double x) { return (2. * coeffs[2] + 6. * coeffs[3] * x) / pow(pow(coeffs[1] + 2. * coeffs[2] * x + 3. * coeffs[3] * x * x, 2.) + 1., 1.5); };
+    double curv2 = 0.;
+    for (double x = minx, dx = (maxx - minx) / 1000; x <= maxx; x += dx)
+    {
+        curv2 += pow(curv(x), 2.) * dx;
+    }
+
+    curv2 /= (maxx - minx);
+    double ref_v = speed_profile(curv2);
+
+    // solve the problem with the object that computes objective and constraints
+    auto start_time = std::chrono::steady_clock::now();
+    plan.iterations = -1;
+    if (backend == Backend::autodiff)
+    {
+        if (model_type == ModelType::dynamic)
+            plan.iterations = workspace->solve_stages(*workspace->dynamic_nlp, coeffs, ref_v);
+        else
+            plan.iterations = workspace->solve_stages(*workspace->kinematic_nlp, coeffs, ref_v);
+    }
+    else if (model_type == ModelType::dynamic)
+    {
+        auto &fg_eval = workspace->dynamic_eval;
+        fg_eval.coeffs = coeffs;
+        fg_eval.ref_v = ref_v;
+        CppAD::ipopt::solve<Dvector, FG_eval<DynamicModel>>(workspace->options, vars, workspace->vars_lowerbound,
+                                                            workspace->vars_upperbound, constraints_lowerbound,
+                                                            constraints_upperbound, fg_eval, solution);
+    }
+    else
+    {
+        auto &fg_eval = workspace->kinematic_eval;
+        fg_eval.coeffs = coeffs;
+        fg_eval.ref_v = ref_v;
+        CppAD::ipopt::solve<Dvector, FG_eval<KinematicModel>>(workspace->options, vars, workspace->vars_lowerbound,
+                                                              workspace->vars_upperbound, constraints_lowerbound,
+                                                              constraints_upperbound, fg_eval, solution);
+    }
+    plan.solve_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+
+    // Check some of the solution values
+    plan.status = plan_status(solution.status);
+    const bool ok = plan.ok();
+    plan.ref_v = ref_v;
+    plan.curvature = curv2;
+    if (!ok)
+    {
+        // The callers send the zero actuations, which then are in flight.
+        plan.N = 0;
+        plan.delta = plan.a = 0.;
+        plan.cost = std::numeric_limits<double>::quiet_NaN();
+        last_delta = plan.delta;
+        history.push(now, plan.delta, plan.a);
+        plan.total_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - solve_start).count();
+        return false;
+    }
+
+    // Copy the trajectories to the plan.
+    plan.N = N;
+    plan.n_states = layout.n_states;
+    plan.cost = solution.obj_value;
+    double t = 0.;
     for (std::size_t i = 0; i < N; ++i)
     {
-        mpc_x_vals.push_back(solution.x[x_start + i]);
-        mpc_y_vals.push_back(solution.x[y_start + i]);
+        for (std::size_t k = 0; k < layout.n_states; ++k)
+        {
+            plan.states[k][i] = solution.x[x_start + k * N + i];
+        }
+        plan.t[i] = t;
+        if (i + 1 < N)
+        {
+            plan.inputs[0][i] = solution.x[delta_start + layout.block[i]];
+            plan.inputs[1][i] = solution.x[a_start + layout.block[i]];
+            t += dt[i];
+        }
     }
 
     // Return the first actuator values.
-    auto delta = solution.x[delta_start + latency_position] +
-        (solution.x[delta_start + latency_position + 1] - solution.x[delta_start + latency_position]) * latency_offset;
-    auto acceleration = solution.x[a_start + latency_position] +
-        (solution.x[a_start + latency_position + 1] - solution.x[a_start + latency_position]) * latency_offset;
-    return {delta, acceleration, mpc_x_vals, mpc_y_vals, cost, ref_v};
+    if (latency_mode == LatencyMode::predict)
+    {
+        plan.delta = solution.x[delta_start];
+        plan.a = solution.x[a_start];
+    }
+    else
+    {
+        // A horizon of one stage has no next actuations.
+        const std::size_t next = std::min(latency_position + 1, layout.block.size() - 1);
+        auto delta0 = solution.x[delta_start + layout.block[latency_position]];
+        auto delta1 = solution.x[delta_start + layout.block[next]];
+        auto a0 = solution.x[a_start + layout.block[latency_position]];
+        auto a1 = solution.x[a_start + layout.block[next]];
+        plan.delta = delta0 + (delta1 - delta0) * latency_offset;
+        plan.a = a0 + (a1 - a0) * latency_offset;
+    }
+    last_delta = plan.delta;
+    history.push(now, plan.delta, plan.a);
+    plan.total_time = std::chrono::duration<double>(std::chrono::steady_clock::now() - solve_start).count();
+    return true;
 }
@@ -1,29 +1,198 @@
 #ifndef MPC_H
 #define MPC_H
 
+#include <array>
+#include <functional>
+#include <memory>
+#include <string>
 #include <vector>
 #include "Eigen-3.3/Eigen/Core"
+#include "Config.h"
+#include "Cost.h"
+#include "Model.h"
+#include "Plan.h"
 
 // For converting back and forth between radians and degrees.
 static inline constexpr double pi() { return M_PI; }
 static inline double deg2rad(double x) { return x * pi() / 180; }
 static inline double rad2deg(double x) { return x * 180 / pi(); }
 
+// Time grid of the horizon and positions of the state and actuator
+// variables in the solver vector.
+//
+// The actuations are move-blocked: the N - 1 stages are split into blocks
+// that share one steering and one acceleration value, so there are only
+// as many actuator variables as blocks.
+struct Layout
+{
+    // n_states is the number of model states, dt are the stage durations in
+    // seconds, blocks are the block lengths in stages and must sum to dt.size().
+    // Throws std::invalid_argument for an empty dt, a duration that is not
+    // positive or blocks that do not cover the stages.
+    Layout(std::size_t n_states, const std::vector<double> &dt, const std::vector<std::size_t> &blocks);
+
+    std::size_t N;                  // number of stages
+    std::size_t n_states;           // number of model states
+    std::vector<double> dt;         // duration of the transition from each stage to the next
+    std::size_t n_blocks;           // number of actuator blocks
+    std::vector<std::size_t> block; // actuator block of each stage
+
+    // State k of the model starts at x_start + k * N, the first six states
+    // are the same for all models.
+    std::size_t x_start, y_start, psi_start, v_start, cte_start, epsi_start;
+    std::size_t delta_start, a_start;
+
+    std::size_t n_vars, n_constraints;
+};
+
+// Compensation of the delay until the actuations are applied.
+enum class LatencyMode
+{
+    interpolate, // plan from the measured state, send the actuations planned for the latency
+    predict      // plan from the state predicted with the commands in flight, send the first actuations
+};
+
+// Parse "interpolate" or "predict", interpolate for anything else.
+LatencyMode make_latency_mode(const std::string &name);
+
+// Evaluator of the objective, the constraints and their derivatives.
+enum class Backend
+{
+    cppad,   // CppAD tape of the whole horizon with exact Hessians
+    autodiff // per stage Eigen AutoDiffScalar blocks, see StageNLP.h
+};
+
+// Parse "cppad" or "autodiff", CppAD for anything else.
+Backend make_backend(const std::string &name);
+
+// CppAD keeps its tapes per thread.  Controllers that solve on several
+// threads at once need setup_parallel_solves before the threads start, and
+// every thread sets its own number in [0, threads) before it solves.
+// Ipopt also needs a thread safe linear solver then, e.g.
+// `--ipopt.linear_solver ma27`, MUMPS is not.  Without the setup all
+// threads solve as number 0 and their solves must not overlap.
+void setup_parallel_solves(std::size_t threads);
+void set_solver_thread(std::size_t number);
+bool parallel_solves_enabled();
+
+// Threads that come and go besides those of setup_parallel_solves, e.g. the
+// worker of a Pipeline, reserve a number of their own above them and give
+// it back when they end.  Reserve returns 0 without parallel solves and
+// throws std::runtime_error once all CPPAD_MAX_NUM_THREADS are taken.
+std::size_t reserve_solver_thread();
+void release_solver_thread(std::size_t number);
+
+// Build a controller of the options to check them before any threads
+// start, an invalid horizon is printed to std::cerr.
+bool check_options(const Config &config);
+
+// Check that `ipopt.linear_solver` names one of the thread safe HSL
+// solvers, the default MUMPS is not.
+bool thread_safe_linear_solver(const Config &config);
+
+class ThreadPool;
+
+// Independent problem for MPC::SolveBatch: the arguments of Solve and the
+// steering angle of the last actuation.
+struct Problem
+{
+    Eigen::VectorXd state, coeffs;
+    double minx = 0., maxx = 0.;
+    double last_delta = 0.;
+};
+
+// The last commands sent to the vehicle with their times, a ring buffer.
+class CommandHistory
+{
+public:
+    void push(double time, double delta, double a);
+
+    // Command that acts at `time` when commands are applied `latency` after
+    // they are sent, false if no command is known to act yet.
+    bool active(double time, double latency, double &delta, double &a) const;
+
+private:
+    struct Command
+    {
+        double time, delta, a;
+    };
+
+    std::array<Command, 16> commands;
+    std::size_t count = 0; // number of commands stored
+    std::size_t next = 0;  // position of the next command
+};
+
 class MPC
 {
 public:
-    MPC();
+    // Reads the horizon options `dt` and `blocks`, the `model`, the `integrator`,
+    // the actuation `latency` in s and its compensation `latency.mode`, the
+    // cost weights `cost.*`, the reference speed profile `speed.*`, the
+    // evaluator `backend` and the `ipopt.linear_solver`.
+    MPC(const Config &config = Config());
 
     virtual ~MPC();
 
-    // Solve the model given an initial state and polynomial coefficients.
-    // Return the first actuatotions.
-    std::tuple<double, double, std::vector<double>, std::vector<double>, double, double>
-    Solve(Eigen::VectorXd state, Eigen::VectorXd coeffs, double minx, double maxx);
+    // Solve the model given an initial state of the kinematic model and
+    // polynomial coefficients of the reference line between minx and maxx.
+    // Write the first actuations and the trajectories to the plan and
+    // return whether the solver succeeded.  The solver starts from the
+    // trajectories of guess if it is given, e.g. a plan of a close state.
+    // The actuations of the plan, zero if the solver failed, are recorded
+    // as sent in history and last_delta.
+    bool Solve(const Eigen::VectorXd &state, const Eigen::VectorXd &coeffs, double minx, double maxx, Plan &plan,
+               const Plan *guess = nullptr);
+
+    // Solve the problems on the workers of pool, each as Solve of a
+    // controller with this configuration and latency but without commands
+    // in flight, and write plans[i] of problems[i].  The commands and
+    // last_delta of this controller are not changed.  The problems are
+    // dealt to the workers in chunks of consecutive ones, every worker
+    // keeps its own controller for the next batches.  A pool of more than
+    // one thread needs setup_parallel_solves.  Return the number of
+    // problems the solver failed on.
+    std::size_t SolveBatch(const std::vector<Problem> &problems, std::vector<Plan> &plans, ThreadPool &pool);
+
+    // Change the compensated latency in s, e.g. to a measured one.
+    void set_latency(double latency);
+
+    // Forget the commands sent and go back to the configured latency, e.g.
+    // before the controller drives another vehicle.
+    void reset();
+
+    Layout layout;
+    ModelType model_type;
+    KinematicModel kinematic_model;
+    DynamicModel dynamic_model;
+    Integrator integrator;
+    Backend backend;
+    Cost cost;
+    SpeedProfile speed_profile;
 
+    // Steering angle of the last actuation.
+    double last_delta;
+
+    // Delay until the actuations are applied in s and its compensation,
+    // change the latency with set_latency.
+    double latency;
+    LatencyMode latency_mode;
+
+    // Stage and fraction of it where the actuations get applied.
     std::size_t latency_position;
     double latency_offset;
 
+    // Commands sent by Solve and the clock in s they are stamped with, the
+    // steady clock by default.  A simulation sets its own clock.
+    CommandHistory history;
+    std::function<double()> clock;
+
+private:
+    struct Workspace;
+    std::unique_ptr<Workspace> workspace;
+
+    // Options of the controllers of SolveBatch, one per worker.
+    Config config;
+    std::vector<std::unique_ptr<MPC>> batch_controllers;
 };
 
 #endif /* MPC_H */
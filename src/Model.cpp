@@ -0,0 +1,19 @@
+#include "Model.h"
+
+Integrator make_integrator(const std::string &name)
+{
+    if (name == "rk2")
+        return Integrator::rk2;
+    if (name == "rk4")
+        return Integrator::rk4;
+    if (name == "arc")
+        return Integrator::arc;
+    return Integrator::euler;
+}
+
+ModelType make_model_type(const std::string &name)
+{
+    if (name == "dynamic")
+        return ModelType::dynamic;
+    return ModelType::kinematic;
+}
@@ -0,0 +1,284 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <cmath>
+#include <string>
+#include "Eigen-3.3/Eigen/Core"
+
+// Vehicle models and the integrators of their stage transitions.
+//
+// The functions are templates on the scalar type so the same code is used
+// with CppAD::AD<double> inside FG_eval and with double for simulation.
+
+// Methods to integrate the model over a stage with constant actuations.
+enum class Integrator
+{
+    euler, // explicit Euler
+    rk2,   // explicit midpoint
+    rk4,   // classical Runge-Kutta
+    arc    // circular arc of the bicycle, model specific
+};
+
+// Parse "euler", "rk2", "rk4" or "arc", Euler for anything else.
+Integrator make_integrator(const std::string &name);
+
+// Vehicle models the controller can use.
+enum class ModelType
+{
+    kinematic, // KinematicModel
+    dynamic    // DynamicModel
+};
+
+// Parse "kinematic" or "dynamic", kinematic for anything else.
+ModelType make_model_type(const std::string &name);
+
+// Reference line polynomial and its tangential angle.
+template <typename T>
+T reference_line(const Eigen::VectorXd &coeffs, const T &x)
+{
+    return coeffs[0] + coeffs[1] * x + coeffs[2] * x * x + coeffs[3] * x * x * x;
+}
+
+template <typename T>
+T reference_angle(const Eigen::VectorXd &coeffs, const T &x)
+{
+    using std::atan;
+    return atan(coeffs[1] + 2 * coeffs[2] * x + 3 * coeffs[3] * x * x);
+}
+
+// sin(z) / z by its Taylor series, the error is below 1e-10 for |z| < 0.5
+// and 3e-8 for |z| < 1, which covers half the heading change over a stage.
+template <typename T>
+T sinc(const T &z)
+{
+    T z2 = z * z;
+    return 1. - z2 / 6. * (1. - z2 / 20. * (1. - z2 / 42. * (1. - z2 / 72.)));
+}
+
+// Kinematic bicycle model extended with the cross track and orientation errors.
+//
+// The error states are not integrated from their previous values: at the
+// beginning of every stage they are anchored to the reference line,
+// cte = f(x) - y and epsi = psi - atan(f'(x)), and the integration only
+// adds the change over the stage.
+struct KinematicModel
+{
+    enum { x, y, psi, v, cte, epsi, n_states };
+    enum { delta, a, n_inputs };
+
+    // This value assumes the model presented in the classroom is used.
+    //
+    // It was obtained by measuring the radius formed by running the vehicle in the
+    // simulator around in a circle with a constant steering angle and velocity on a
+    // flat terrain.
+    //
+    // Lf was tuned until the the radius formed by the simulating the model
+    // presented in the classroom matched the previous radius.
+    //
+    // This is the length from front to CoG that has a similar radius.
+    double Lf = 2.67;
+
+    template <typename T>
+    void derivatives(const T *s, const T *u, T *ds) const
+    {
+        using std::cos;
+        using std::sin;
+        ds[x] = s[v] * cos(s[psi]);
+        ds[y] = s[v] * sin(s[psi]);
+        ds[psi] = s[v] * u[delta] / Lf;
+        ds[v] = u[a];
+        ds[cte] = s[v] * sin(s[epsi]);
+        ds[epsi] = s[v] * u[delta] / Lf;
+    }
+
+    template <typename T>
+    void anchor(const T *s, const Eigen::VectorXd &coeffs, T *base) const
+    {
+        for (int k = 0; k < n_states; ++k)
+            base[k] = s[k];
+        base[cte] = reference_line(coeffs, s[x]) - s[y];
+        base[epsi] = s[psi] - reference_angle(coeffs, s[x]);
+    }
+
+    // Change of the state along a circular arc at the mean speed of the stage.
+    template <typename T>
+    void arc(const T *s, const T *u, double h, T *change) const
+    {
+        using std::cos;
+        using std::sin;
+        T v_mean = s[v] + u[a] * (h / 2.);
+        T turn = v_mean * u[delta] / Lf * h;
+        T chord = v_mean * h * sinc<T>(turn / 2.);
+        change[x] = chord * cos(s[psi] + turn / 2.);
+        change[y] = chord * sin(s[psi] + turn / 2.);
+        change[psi] = turn;
+        change[v] = u[a] * h;
+        change[cte] = chord * sin(s[epsi] + turn / 2.);
+        change[epsi] = turn;
+    }
+
+    // The state from the telemetry is complete.
+    template <typename T>
+    void extend(T *, double) const {}
+};
+
+// Dynamic bicycle model with linear tire forces.
+//
+// The first six states are those of the kinematic model, with v the
+// longitudinal velocity, so the cost terms and the initial state handling
+// are shared, followed by the lateral velocity and the yaw rate.
+//
+// The tire forces make the lateral dynamics stiff at low speed, so below
+// about blend_speed the derivatives of the lateral velocity and the yaw rate
+// are smoothly blended with a relaxation towards the kinematic model.
+// The parameters are nominal values for a mid-size car, not identified
+// for the simulator, but the axle distances sum up to the Lf of the
+// kinematic model.
+struct DynamicModel
+{
+    enum { x, y, psi, v, cte, epsi, vy, r, n_states };
+    enum { delta, a, n_inputs };
+
+    double mass = 1500.;       // kg
+    double inertia = 2500.;    // yaw moment of inertia in kg m^2
+    double lf = 1.2;           // front axle to CoG in m
+    double lr = 1.47;          // rear axle to CoG in m
+    double cf = 80000.;        // front cornering stiffness in N/rad
+    double cr = 80000.;        // rear cornering stiffness in N/rad
+    double blend_speed = 5.;   // in m/s
+    double relaxation = 0.1;   // time constant towards the kinematic model in s
+
+    template <typename T>
+    void derivatives(const T *s, const T *u, T *ds) const
+    {
+        using std::cos;
+        using std::sin;
+        using std::sqrt;
+
+        // Slip angles with the longitudinal velocity kept away from zero.
+        T vx = sqrt(s[v] * s[v] + 1.);
+        T alpha_f = u[delta] - (s[vy] + lf * s[r]) / vx;
+        T alpha_r = -(s[vy] - lr * s[r]) / vx;
+        T fyf = cf * alpha_f;
+        T fyr = cr * alpha_r;
+
+        T cos_delta = cos(u[delta]);
+        T dvy_dynamic = (fyf * cos_delta + fyr) / mass - s[r] * s[v];
+        T dr_dynamic = (lf * fyf * cos_delta - lr * fyr) / inertia;
+
+        // Kinematic steady state of the lateral velocity and the yaw rate.
+        T r_kinematic = s[v] * u[delta] / (lf + lr);
+        T dvy_kinematic = (lr * r_kinematic - s[vy]) / relaxation;
+        T dr_kinematic = (r_kinematic - s[r]) / relaxation;
+
+        T w = s[v] * s[v] / (s[v] * s[v] + blend_speed * blend_speed);
+
+        ds[x] = s[v] * cos(s[psi]) - s[vy] * sin(s[psi]);
+        ds[y] = s[v] * sin(s[psi]) + s[vy] * cos(s[psi]);
+        ds[psi] = s[r];
+        ds[v] = u[a] - fyf * sin(u[delta]) / mass * w + s[r] * s[vy];
+        ds[cte] = s[v] * sin(s[epsi]) + s[vy] * cos(s[epsi]);
+        ds[epsi] = s[r];
+        ds[vy] = w * dvy_dynamic + (1. - w) * dvy_kinematic;
+        ds[r] = w * dr_dynamic + (1. - w) * dr_kinematic;
+    }
+
+    template <typename T>
+    void anchor(const T *s, const Eigen::VectorXd &coeffs, T *base) const
+    {
+        for (int k = 0; k < n_states; ++k)
+            base[k] = s[k];
+        base[cte] = reference_line(coeffs, s[x]) - s[y];
+        base[epsi] = s[psi] - reference_angle(coeffs, s[x]);
+    }
+
+    // Change of the state along a circular arc with the body velocities and
+    // the yaw rate at the middle of the stage, which are advanced by the
+    // midpoint rule.
+    template <typename T>
+    void arc(const T *s, const T *u, double h, T *change) const
+    {
+        using std::cos;
+        using std::sin;
+        T ds[n_states], mid[n_states];
+        derivatives(s, u, ds);
+        for (int k = 0; k < n_states; ++k)
+            mid[k] = s[k] + ds[k] * (h / 2.);
+        derivatives(mid, u, ds);
+
+        T turn = mid[r] * h;
+        T factor = h * sinc<T>(turn / 2.);
+        T heading = s[psi] + turn / 2.;
+        T heading_error = s[epsi] + turn / 2.;
+        change[x] = factor * (mid[v] * cos(heading) - mid[vy] * sin(heading));
+        change[y] = factor * (mid[v] * sin(heading) + mid[vy] * cos(heading));
+        change[psi] = turn;
+        change[v] = ds[v] * h;
+        change[cte] = factor * (mid[v] * sin(heading_error) + mid[vy] * cos(heading_error));
+        change[epsi] = turn;
+        change[vy] = ds[vy] * h;
+        change[r] = ds[r] * h;
+    }
+
+    // Extend the kinematic state with no side slip and the yaw rate of the
+    // last steering angle.
+    template <typename T>
+    void extend(T *s, double last_delta) const
+    {
+        s[vy] = 0.;
+        s[r] = s[v] * last_delta / (lf + lr);
+    }
+};
+
+// Predict the state s1 at the end of a stage of duration h that starts at s0
+// with the actuations u.
+template <typename Model, typename T>
+void transition(const Model &model, Integrator integrator, const Eigen::VectorXd &coeffs,
+                const T *s0, const T *u, double h, T *s1)
+{
+    const int n = Model::n_states;
+    T change[n], k1[n], k2[n], k3[n], k4[n], tmp[n];
+
+    switch (integrator)
+    {
+    case Integrator::euler:
+        model.derivatives(s0, u, k1);
+        for (int k = 0; k < n; ++k)
+            change[k] = k1[k] * h;
+        break;
+
+    case Integrator::rk2:
+        model.derivatives(s0, u, k1);
+        for (int k = 0; k < n; ++k)
+            tmp[k] = s0[k] + k1[k] * (h / 2.);
+        model.derivatives(tmp, u, k2);
+        for (int k = 0; k < n; ++k)
+            change[k] = k2[k] * h;
+        break;
+
+    case Integrator::rk4:
+        model.derivatives(s0, u, k1);
+        for (int k = 0; k < n; ++k)
+            tmp[k] = s0[k] + k1[k] * (h / 2.);
+        model.derivatives(tmp, u, k2);
+        for (int k = 0; k < n; ++k)
+            tmp[k] = s0[k] + k2[k] * (h / 2.);
+        model.derivatives(tmp, u, k3);
+        for (int k = 0; k < n; ++k)
+            tmp[k] = s0[k] + k3[k] * h;
+        model.derivatives(tmp, u, k4);
+        for (int k = 0; k < n; ++k)
+            change[k] = (k1[k] + 2. * k2[k] + 2. * k3[k] + k4[k]) * (h / 6.);
+        break;
+
+    case Integrator::arc:
+        model.arc(s0, u, h, change);
+        break;
+    }
+
+    model.anchor(s0, coeffs, s1);
+    for (int k = 0; k < n; ++k)
+        s1[k] += change[k];
+}
+
+#endif /* MODEL_H */
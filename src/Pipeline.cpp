@@ -0,0 +1,167 @@
+#include "Pipeline.h"
+#include <algorithm>
+#include <cmath>
+
+namespace
+{
+
+// Held by every solve of all pipelines unless the solves are parallel.
+std::mutex serial_solves;
+
+}
+
+Pipeline::Pipeline(MPC &mpc, const Config &config)
+    : mpc(mpc), speculative(config), position(config.get("pipeline.position", 0.2)),
+      heading(config.get("pipeline.heading", 0.02)), speed(config.get("pipeline.speed", 0.5)),
+      initial_period(config.get("pipeline.period", 0.1)), period(initial_period),
+      solves(parallel_solves_enabled() ? own_solves : serial_solves), solver_thread(reserve_solver_thread()),
+      worker(&Pipeline::run, this)
+{
+}
+
+Pipeline::~Pipeline()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    condition.notify_all();
+    worker.join();
+    release_solver_thread(solver_thread);
+}
+
+bool Pipeline::Solve(const Telemetry &telemetry, const CarFrame &frame, Plan &out)
+{
+    // Follow the frame period, gaps of manual driving are left out.
+    const double now = mpc.clock();
+    if (last_arrival >= 0. && now - last_arrival < 1.)
+        period += 0.2 * (now - last_arrival - period);
+    last_arrival = now;
+
+    const auto &x_vals = frame.x_vals;
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!pending)
+    {
+        ++cold;
+        std::lock_guard<std::mutex> solve(solves);
+        return mpc.Solve(frame.state, frame.coeffs, x_vals.front(), x_vals.back(), out);
+    }
+    condition.wait(lock, [this] { return done; });
+    pending = false;
+    lock.unlock();
+
+    if (!ok)
+    {
+        ++cold;
+        std::lock_guard<std::mutex> solve(solves);
+        return mpc.Solve(frame.state, frame.coeffs, x_vals.front(), x_vals.back(), out);
+    }
+    if (!close(telemetry))
+    {
+        ++warm;
+        std::lock_guard<std::mutex> solve(solves);
+        return mpc.Solve(frame.state, frame.coeffs, x_vals.front(), x_vals.back(), out, &plan);
+    }
+
+    // Take over the speculative plan as if mpc had solved it.
+    ++accepted;
+    out = plan;
+    mpc.last_delta = out.delta;
+    mpc.history.push(now, out.delta, out.a);
+    return true;
+}
+
+void Pipeline::speculate(const Telemetry &telemetry, const Plan &current)
+{
+    if (!current.ok() || current.N < 2)
+        return;
+
+    // A speculation that was not picked up is dropped.
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this] { return !pending || done; });
+    pending = false;
+    lock.unlock();
+
+    // State of the plan at the arrival of the next frame, in predict mode
+    // the plan starts at the latency.
+    double t = period - (mpc.latency_mode == LatencyMode::predict ? mpc.latency : 0.);
+    t = std::max(0., std::min(t, current.t[current.N - 1]));
+    std::size_t i = 0;
+    while (i + 2 < current.N && current.t[i + 1] <= t)
+        ++i;
+    const double f = std::min(1., (t - current.t[i]) / (current.t[i + 1] - current.t[i]));
+    auto at = [&](std::size_t k) { return current.states[k][i] + (current.states[k][i + 1] - current.states[k][i]) * f; };
+
+    // Back to global coordinates.
+    const double x = at(KinematicModel::x), y = at(KinematicModel::y);
+    const double cos_psi = std::cos(telemetry.psi), sin_psi = std::sin(telemetry.psi);
+    predicted.x = telemetry.x + x * cos_psi - y * sin_psi;
+    predicted.y = telemetry.y + x * sin_psi + y * cos_psi;
+    predicted.psi = telemetry.psi + at(KinematicModel::psi);
+    predicted.speed = at(KinematicModel::v) * 3600. / 1609.34; // in mph
+    predicted.ptsx = telemetry.ptsx;
+    predicted.ptsy = telemetry.ptsy;
+    to_car_frame(predicted, predicted_frame);
+
+    // The speculative controller continues from the state of mpc.
+    speculative.set_latency(mpc.latency);
+    speculative.last_delta = mpc.last_delta;
+    speculative.history = mpc.history;
+    const double arrival = mpc.clock() + period;
+    speculative.clock = [arrival] { return arrival; };
+
+    lock.lock();
+    pending = true;
+    done = false;
+    lock.unlock();
+    condition.notify_all();
+}
+
+void Pipeline::reset()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    condition.wait(lock, [this] { return !pending || done; });
+    pending = false;
+    lock.unlock();
+
+    speculative.reset();
+    period = initial_period;
+    last_arrival = -1.;
+    accepted = warm = cold = 0;
+}
+
+void Pipeline::run()
+{
+    set_solver_thread(solver_thread);
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true)
+    {
+        condition.wait(lock, [this] { return stop || (pending && !done); });
+        if (stop)
+            return;
+
+        lock.unlock();
+        bool solved;
+        {
+            std::lock_guard<std::mutex> solve(solves);
+            const auto &x_vals = predicted_frame.x_vals;
+            solved = speculative.Solve(predicted_frame.state, predicted_frame.coeffs, x_vals.front(), x_vals.back(), plan);
+        }
+        lock.lock();
+
+        ok = solved;
+        done = true;
+        condition.notify_all();
+    }
+}
+
+bool Pipeline::close(const Telemetry &telemetry) const
+{
+    // The simulator sends the next waypoints, which change along the track.
+    if (telemetry.ptsx != predicted.ptsx || telemetry.ptsy != predicted.ptsy)
+        return false;
+
+    const double dpsi = std::remainder(telemetry.psi - predicted.psi, 2. * M_PI);
+    return std::hypot(telemetry.x - predicted.x, telemetry.y - predicted.y) <= position
+        && std::fabs(dpsi) <= heading && std::fabs(telemetry.speed - predicted.speed) <= speed;
+}
@@ -0,0 +1,82 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <thread>
+#include "Config.h"
+#include "MPC.h"
+#include "Plan.h"
+#include "Telemetry.h"
+
+// Speculative solves of the next frame.
+//
+// Once a frame is solved, the telemetry of the next frame is predicted
+// along the plan at the measured frame period and solved on a worker thread
+// with a second controller, while the reply is sent and the next frame is
+// on its way.  If the next telemetry is within the tolerances of the
+// prediction its speculative plan is used as it is, otherwise it is the
+// warm start of the solve.
+//
+// The solves of the two controllers never overlap, a solve waits for the
+// speculative one to finish.  The solves of different pipelines, e.g. of
+// the sessions of several connections, overlap only with parallel solves,
+// where every worker solves with a CppAD thread number of its own,
+// otherwise one lock of all pipelines keeps them apart.
+class Pipeline
+{
+public:
+    // Reads the tolerances `pipeline.position` in m, `pipeline.heading` in
+    // rad and `pipeline.speed` in mph and the initial `pipeline.period` in s,
+    // the speculative controller is configured by config as mpc.  The
+    // worker reserves a CppAD thread number, see reserve_solver_thread.
+    Pipeline(MPC &mpc, const Config &config);
+    ~Pipeline();
+
+    Pipeline(const Pipeline &) = delete;
+    Pipeline &operator=(const Pipeline &) = delete;
+
+    // Solve the telemetry and its frame into plan, as MPC::Solve does.
+    bool Solve(const Telemetry &telemetry, const CarFrame &frame, Plan &plan);
+
+    // Start the speculative solve of the frame after the one of plan.
+    void speculate(const Telemetry &telemetry, const Plan &plan);
+
+    // Drop the speculation and the measured period and reset the counters,
+    // e.g. before mpc drives another vehicle.
+    void reset();
+
+    // Frames that used the speculative plan, used it as a warm start or
+    // were solved from scratch.
+    std::size_t accepted = 0, warm = 0, cold = 0;
+
+private:
+    void run();
+    bool close(const Telemetry &telemetry) const;
+
+    MPC &mpc;
+    MPC speculative;
+    double position, heading, speed; // tolerances
+    double initial_period;           // configured period in s
+    double period;                   // between the frames in s
+    double last_arrival = -1.;
+
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool pending = false; // a speculative solve was started
+    bool done = false;    // and finished
+    bool stop = false;
+
+    Telemetry predicted;
+    CarFrame predicted_frame;
+    Plan plan;
+    bool ok = false;
+
+    std::mutex own_solves;     // of the two controllers
+    std::mutex &solves;        // own_solves or, without parallel solves, of all pipelines
+    std::size_t solver_thread; // CppAD thread number of the worker
+    std::thread worker;
+};
+
+#endif /* PIPELINE_H */
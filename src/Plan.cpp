@@ -0,0 +1,40 @@
+#include "Plan.h"
+#include <cmath>
+
+double Plan::trajectory_curvature() const
+{
+    if (N < 3)
+        return 0.;
+
+    // Finite differences on the non-uniform time grid,
+    // h0 and h1 are the durations of the stages before and after point i.
+    auto curvature_at = [this](std::size_t i) {
+        const double h0 = t[i] - t[i - 1], h1 = t[i + 1] - t[i];
+        auto diff = [&](const double *f) {
+            return -h1 / (h0 * (h0 + h1)) * f[i - 1] + (h1 - h0) / (h0 * h1) * f[i] + h0 / (h1 * (h0 + h1)) * f[i + 1];
+        };
+        auto diff2 = [&](const double *f) {
+            return 2. * (f[i - 1] / (h0 * (h0 + h1)) - f[i] / (h0 * h1) + f[i + 1] / (h1 * (h0 + h1)));
+        };
+        const double dx = diff(x()), dy = diff(y());
+        const double d2x = diff2(x()), d2y = diff2(y());
+        const double speed2 = dx * dx + dy * dy;
+        return (dx * d2y - dy * d2x) / (speed2 * std::sqrt(speed2));
+    };
+
+    // Trapezoidal mean over the horizon, the end values are held over the
+    // first and the last stage.
+    double previous = std::pow(curvature_at(1), 2.);
+    double sum = previous * (t[1] - t[0]);
+    for (std::size_t i = 2; i < N - 1; ++i)
+    {
+        const double current = std::pow(curvature_at(i), 2.);
+        sum += (current + previous) * (t[i] - t[i - 1]) / 2.;
+        previous = current;
+    }
+    sum += previous * (t[N - 1] - t[N - 2]);
+
+    // Divided by N mean stage durations, as by N * dt on the uniform grid
+    // of the earlier logs, not by the horizon of N - 1 stages.
+    return sum / ((t[N - 1] - t[0]) * N / (N - 1));
+}
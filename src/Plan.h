@@ -0,0 +1,68 @@
+#ifndef PLAN_H
+#define PLAN_H
+
+#include <array>
+#include <cstddef>
+
+// Capacity of a plan, the horizon can not be longer.
+const std::size_t max_stages = 128;
+const std::size_t max_states = 8;
+const std::size_t max_inputs = 2;
+
+// Outcome of the solve of a plan.
+enum class PlanStatus
+{
+    none,           // not solved
+    success,        // the solver converged
+    max_iterations, // the solver hit its iteration or time limit
+    acceptable,     // the solver stopped at an acceptable point
+    infeasible,     // the solver converged to an infeasible point
+    failed          // any other solver error
+};
+
+// Result of one controller cycle.
+//
+// A plan is owned by the caller, has a fixed capacity and is overwritten by
+// every MPC::Solve, so the serializer, the logger and the warm start can
+// read it without copies.  All values are in the vehicle coordinate system
+// of the cycle.
+struct Plan
+{
+    // Actuations to send, after the latency compensation.
+    double delta = 0.; // steering angle in rad, positive to the left
+    double a = 0.;     // throttle in [-1, 1]
+
+    std::size_t N = 0;        // number of stages
+    std::size_t n_states = 0; // number of model states
+
+    // Predicted state k at stage i is states[k][i], the first six states are
+    // x, y, psi, v, cte and epsi.  Actuations are expanded to the stages,
+    // inputs[0][i] and inputs[1][i] are the steering and the throttle from
+    // stage i to i + 1.
+    std::array<std::array<double, max_stages>, max_states> states;
+    std::array<std::array<double, max_stages>, max_inputs> inputs;
+
+    // Time of each stage from the beginning of the horizon in s.
+    std::array<double, max_stages> t;
+
+    double cost = 0.;      // objective value
+    double ref_v = 0.;     // reference speed in m/s
+    double curvature = 0.; // mean squared curvature of the reference line in 1/m^2
+    PlanStatus status = PlanStatus::none;
+    int iterations = -1;   // Ipopt iterations, -1 if the backend does not report them
+    double solve_time = 0.; // wall time of the solver in s
+    double total_time = 0.; // wall time of Solve in s
+
+    // The trajectories and actuations are those of a converged solve.
+    bool ok() const { return status == PlanStatus::success; }
+
+    // Mean squared curvature of the predicted trajectory in 1/m^2, computed
+    // on demand since only the diagnostics need it.  The integral is divided
+    // by N mean stage durations, N * dt on a uniform grid, as in earlier logs.
+    double trajectory_curvature() const;
+
+    const double *x() const { return states[0].data(); }
+    const double *y() const { return states[1].data(); }
+};
+
+#endif /* PLAN_H */
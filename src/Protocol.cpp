@@ -0,0 +1,364 @@
+#include "Protocol.h"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+namespace
+{
+
+// Handler of the events of a telemetry message, the array of the event name
+// and the data object.  Fields of telemetry that are not in the message keep
+// their values.
+class TelemetryReader
+{
+public:
+    explicit TelemetryReader(Telemetry &telemetry) : telemetry(telemetry) {}
+
+    bool start_object()
+    {
+        ++depth;
+        return true;
+    }
+
+    bool end_object()
+    {
+        --depth;
+        field = none;
+        return true;
+    }
+
+    bool start_array()
+    {
+        ++depth;
+        if (field == ptsx)
+            telemetry.ptsx.clear();
+        else if (field == ptsy)
+            telemetry.ptsy.clear();
+        return true;
+    }
+
+    bool end_array()
+    {
+        --depth;
+        field = none;
+        return true;
+    }
+
+    bool key(const std::string &name)
+    {
+        field = none;
+        if (depth != 2)
+            return true;
+        if (name == "ptsx")
+            field = ptsx;
+        else if (name == "ptsy")
+            field = ptsy;
+        else if (name == "x")
+            field = x;
+        else if (name == "y")
+            field = y;
+        else if (name == "psi")
+            field = psi; // in rad
+        else if (name == "speed")
+            field = speed; // in mph
+        return true;
+    }
+
+    bool string(const std::string &value)
+    {
+        // The first element of the event array is its name.
+        if (depth == 1 && !named)
+        {
+            named = true;
+            return value == "telemetry";
+        }
+        field = none;
+        return true;
+    }
+
+    bool number(double value)
+    {
+        switch (field)
+        {
+        case ptsx:
+            telemetry.ptsx.push_back(value);
+            return true;
+        case ptsy:
+            telemetry.ptsy.push_back(value);
+            return true;
+        case x:
+            telemetry.x = value;
+            break;
+        case y:
+            telemetry.y = value;
+            break;
+        case psi:
+            telemetry.psi = value;
+            break;
+        case speed:
+            telemetry.speed = value;
+            break;
+        case none:
+            break;
+        }
+        field = none;
+        return true;
+    }
+
+    bool boolean(bool)
+    {
+        field = none;
+        return true;
+    }
+
+    bool null()
+    {
+        field = none;
+        return true;
+    }
+
+private:
+    enum Field { none, ptsx, ptsy, x, y, psi, speed };
+
+    Telemetry &telemetry;
+    Field field = none; // field of the next value
+    int depth = 0;      // nesting of arrays and objects
+    bool named = false; // the event name was read
+};
+
+const std::uint32_t magic = 0x4243504d; // "MPCB" in little endian
+const std::size_t header_size = 8;
+
+// Limit of the points of a message, so a corrupt count is not allocated.
+const std::uint32_t max_points = 4096;
+
+void put_u16(std::string &out, std::uint16_t value)
+{
+    out.push_back(static_cast<char>(value & 0xff));
+    out.push_back(static_cast<char>(value >> 8));
+}
+
+void put_u32(std::string &out, std::uint32_t value)
+{
+    for (int k = 0; k < 4; ++k)
+        out.push_back(static_cast<char>((value >> (8 * k)) & 0xff));
+}
+
+void put_f64(std::string &out, double value)
+{
+    std::uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (int k = 0; k < 8; ++k)
+        out.push_back(static_cast<char>((bits >> (8 * k)) & 0xff));
+}
+
+void put_header(std::string &out, MessageType type)
+{
+    out.clear();
+    put_u32(out, magic);
+    put_u16(out, protocol_version);
+    put_u16(out, static_cast<std::uint16_t>(type));
+}
+
+// Sequential reads from a message with bounds checks.
+class Reader
+{
+public:
+    Reader(const char *data, std::size_t length)
+        : p(reinterpret_cast<const unsigned char *>(data)), end(p + length) {}
+
+    bool u16(std::uint16_t &value)
+    {
+        if (end - p < 2)
+            return false;
+        value = static_cast<std::uint16_t>(p[0] | p[1] << 8);
+        p += 2;
+        return true;
+    }
+
+    bool u32(std::uint32_t &value)
+    {
+        if (end - p < 4)
+            return false;
+        value = 0;
+        for (int k = 0; k < 4; ++k)
+            value |= static_cast<std::uint32_t>(p[k]) << (8 * k);
+        p += 4;
+        return true;
+    }
+
+    bool f64(double &value)
+    {
+        if (end - p < 8)
+            return false;
+        std::uint64_t bits = 0;
+        for (int k = 0; k < 8; ++k)
+            bits |= static_cast<std::uint64_t>(p[k]) << (8 * k);
+        std::memcpy(&value, &bits, sizeof(value));
+        p += 8;
+        return true;
+    }
+
+    // A count of points followed by two arrays of them.
+    bool points(std::vector<double> &first, std::vector<double> &second)
+    {
+        std::uint32_t n;
+        if (!u32(n) || n > max_points || static_cast<std::size_t>(end - p) < 16 * std::size_t(n))
+            return false;
+        first.resize(n);
+        second.resize(n);
+        for (auto &value : first)
+            f64(value);
+        for (auto &value : second)
+            f64(value);
+        return true;
+    }
+
+    bool done() const { return p == end; }
+
+private:
+    const unsigned char *p, *end;
+};
+
+void put_points(std::string &out, const std::vector<double> &first, const std::vector<double> &second)
+{
+    std::size_t n = std::min(first.size(), second.size());
+    put_u32(out, static_cast<std::uint32_t>(n));
+    for (std::size_t i = 0; i < n; ++i)
+        put_f64(out, first[i]);
+    for (std::size_t i = 0; i < n; ++i)
+        put_f64(out, second[i]);
+}
+
+}
+
+bool event_data(const char *data, std::size_t length, const char *&begin, const char *&end)
+{
+    const char *last = data + length;
+    const char *b1 = std::find(data, last, '[');
+    const char *b2 = nullptr;
+    for (const char *p = last - 1; p > b1; --p)
+    {
+        if (p[-1] == '}' && p[0] == ']')
+        {
+            b2 = p + 1;
+            break;
+        }
+    }
+    if (b1 == last || b2 == nullptr)
+        return false;
+
+    static const char null[] = "null";
+    if (std::search(data, last, null, null + 4) != last)
+        return false;
+
+    begin = b1;
+    end = b2;
+    return true;
+}
+
+bool read_telemetry(const char *begin, const char *end, Telemetry &telemetry, std::string &buffer)
+{
+    buffer.assign(begin, end);
+    buffer.append(8, ' ');
+    TelemetryReader reader(telemetry);
+    return nlohmann::json::sax_parse(buffer.data(), buffer.data() + buffer.size(), reader);
+}
+
+void format_telemetry(const Telemetry &telemetry, std::string &message)
+{
+    nlohmann::json data;
+    data["ptsx"] = telemetry.ptsx;
+    data["ptsy"] = telemetry.ptsy;
+    data["psi_unity"] = std::fmod(2.5 * M_PI - telemetry.psi, 2. * M_PI);
+    data["psi"] = telemetry.psi;
+    data["x"] = telemetry.x;
+    data["y"] = telemetry.y;
+    data["steering_angle"] = 0.;
+    data["throttle"] = 0.;
+    data["speed"] = telemetry.speed;
+    message = "42[\"telemetry\"," + data.dump() + "]";
+}
+
+void format_steer(const Steer &steer, std::string &message)
+{
+    arena_json msgJson;
+    msgJson["steering_angle"] = steer.steering_angle;
+    msgJson["throttle"] = steer.throttle;
+
+    //Display the MPC predicted trajectory
+    //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
+    // the points in the simulator are connected by a Green line
+    msgJson["mpc_x"] = steer.mpc_x;
+    msgJson["mpc_y"] = steer.mpc_y;
+
+    //Display the waypoints/reference line
+    //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
+    // the points in the simulator are connected by a Yellow line
+    msgJson["next_x"] = steer.next_x;
+    msgJson["next_y"] = steer.next_y;
+
+    message = "42[\"steer\"," + msgJson.dump() + "]";
+}
+
+MessageType message_type(const char *data, std::size_t length, std::uint16_t &version)
+{
+    Reader reader(data, length);
+    std::uint32_t m;
+    std::uint16_t type;
+    if (!reader.u32(m) || m != magic || !reader.u16(version) || !reader.u16(type))
+        return MessageType::invalid;
+    switch (static_cast<MessageType>(type))
+    {
+    case MessageType::hello:
+    case MessageType::telemetry:
+    case MessageType::steer:
+        return static_cast<MessageType>(type);
+    default:
+        return MessageType::invalid;
+    }
+}
+
+void encode_hello(std::string &message)
+{
+    put_header(message, MessageType::hello);
+}
+
+void encode_telemetry(const Telemetry &telemetry, std::string &message)
+{
+    put_header(message, MessageType::telemetry);
+    put_f64(message, telemetry.x);
+    put_f64(message, telemetry.y);
+    put_f64(message, telemetry.psi);
+    put_f64(message, telemetry.speed);
+    put_points(message, telemetry.ptsx, telemetry.ptsy);
+}
+
+void encode_steer(const Steer &steer, std::string &message)
+{
+    put_header(message, MessageType::steer);
+    put_f64(message, steer.steering_angle);
+    put_f64(message, steer.throttle);
+    put_points(message, steer.mpc_x, steer.mpc_y);
+    put_points(message, steer.next_x, steer.next_y);
+}
+
+bool decode_telemetry(const char *data, std::size_t length, Telemetry &telemetry)
+{
+    std::uint16_t version;
+    if (message_type(data, length, version) != MessageType::telemetry)
+        return false;
+    Reader reader(data + header_size, length - header_size);
+    return reader.f64(telemetry.x) && reader.f64(telemetry.y) && reader.f64(telemetry.psi) &&
+           reader.f64(telemetry.speed) && reader.points(telemetry.ptsx, telemetry.ptsy) && reader.done();
+}
+
+bool decode_steer(const char *data, std::size_t length, Steer &steer)
+{
+    std::uint16_t version;
+    if (message_type(data, length, version) != MessageType::steer)
+        return false;
+    Reader reader(data + header_size, length - header_size);
+    return reader.f64(steer.steering_angle) && reader.f64(steer.throttle) &&
+           reader.points(steer.mpc_x, steer.mpc_y) && reader.points(steer.next_x, steer.next_y) && reader.done();
+}
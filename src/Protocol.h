@@ -0,0 +1,126 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include "Arena.h"
+#include "Telemetry.h"
+#include "json.hpp"
+
+// Messages exchanged with the simulator, see DATA.md.
+//
+// The simulator speaks socket.io over the websocket: "42" starts an event
+// and is followed by a JSON array of the event name and its data.
+//
+// In-house simulators and test rigs can use a binary framing instead, sent
+// as websocket BINARY messages.  Values are little endian and doubles are
+// IEEE 754 binary64.  Every message starts with the header
+//
+//   u32 magic "MPCB", u16 version, u16 type
+//
+// followed by the body of the type:
+//
+//   hello     (1)  none
+//   telemetry (2)  f64 x, y, psi, speed, u32 n, f64 ptsx[n], ptsy[n]
+//   steer     (3)  f64 steering_angle, throttle, u32 n, f64 mpc_x[n], mpc_y[n],
+//                  u32 m, f64 next_x[m], next_y[m]
+//
+// A connection starts with JSON text.  The client switches it by sending
+// hello, the server answers with a hello of its own version and uses the
+// binary framing if the versions match.
+
+// Reply to a telemetry event.
+struct Steer
+{
+    double steering_angle = 0.;         // in [-1, 1], positive to the right
+    double throttle = 0.;               // in [-1, 1]
+    std::vector<double> mpc_x, mpc_y;   // predicted trajectory in the vehicle coordinate system
+    std::vector<double> next_x, next_y; // reference line in the vehicle coordinate system
+};
+
+// JSON documents allocated from the current arena of the thread.
+using arena_json = nlohmann::basic_json<std::map, std::vector, std::string, bool, std::int64_t,
+                                        std::uint64_t, double, ArenaAllocator>;
+
+// Locate the JSON array of an event in a message without copying it.
+// Returns false if the event has no data, which means manual driving.
+bool event_data(const char *data, std::size_t length, const char *&begin, const char *&end);
+
+// Copy a JSON array of numbers into values, reusing their storage.
+template <typename Json>
+void get_values(const Json &array, std::vector<double> &values)
+{
+    values.resize(array.size());
+    for (std::size_t i = 0; i < values.size(); ++i)
+        values[i] = array[i].template get<double>();
+}
+
+// Parse the JSON array of an event into telemetry.  Returns false for
+// events other than telemetry.  With arena_json the document is allocated
+// from the current arena and the vectors of telemetry keep their storage,
+// so a steady state parse does not touch the heap.
+//
+// The lexer copies the rest of its input into a string once it is within
+// five characters of the end, which allocates when the input ends with a
+// long number, so the input is copied into buffer with trailing spaces.
+template <typename Json>
+bool parse_telemetry(const char *begin, const char *end, Telemetry &telemetry, std::string &buffer)
+{
+    buffer.assign(begin, end);
+    buffer.append(8, ' ');
+    auto j = Json::parse(buffer.data(), buffer.data() + buffer.size());
+    if (j[0].template get<std::string>() != "telemetry")
+        return false;
+
+    // j[1] is the data JSON object
+    auto &data = j[1];
+    get_values(data["ptsx"], telemetry.ptsx);
+    get_values(data["ptsy"], telemetry.ptsy);
+    telemetry.x = data["x"];
+    telemetry.y = data["y"];
+    telemetry.psi = data["psi"];     // in rad
+    telemetry.speed = data["speed"]; // in mph
+    return true;
+}
+
+// Read the JSON array of an event into telemetry with the event parser of
+// json.hpp, which fills the fields without building a document.  Returns
+// false for events other than telemetry, buffer is the padded input as for
+// parse_telemetry.
+bool read_telemetry(const char *begin, const char *end, Telemetry &telemetry, std::string &buffer);
+
+// Format a telemetry event as the simulator sends it.
+void format_telemetry(const Telemetry &telemetry, std::string &message);
+
+// Format a steer event, the document is allocated from the current arena.
+void format_steer(const Steer &steer, std::string &message);
+
+// Types and version of the binary messages.
+enum class MessageType : std::uint16_t
+{
+    invalid = 0,
+    hello = 1,
+    telemetry = 2,
+    steer = 3
+};
+
+const std::uint16_t protocol_version = 1;
+
+// Type of a binary message, invalid for a wrong magic or a short message.
+// The version of the sender is stored in version.
+MessageType message_type(const char *data, std::size_t length, std::uint16_t &version);
+
+// Encode binary messages into message, reusing its storage.
+void encode_hello(std::string &message);
+void encode_telemetry(const Telemetry &telemetry, std::string &message);
+void encode_steer(const Steer &steer, std::string &message);
+
+// Decode binary messages, false if the message is not of the type or
+// truncated.  The vectors keep their storage.
+bool decode_telemetry(const char *data, std::size_t length, Telemetry &telemetry);
+bool decode_steer(const char *data, std::size_t length, Steer &steer);
+
+#endif /* PROTOCOL_H */
@@ -0,0 +1,363 @@
+#include "RunLog.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+const char *const run_column_names[run_columns] = {"px", "py", "psi", "v", "cost", "steer", "throttle", "ref_v"};
+
+namespace
+{
+
+const std::uint32_t magic = 0x4c43504d; // "MPCL" in little endian
+const std::uint16_t version = 1;
+const std::size_t footer_size = 16;
+
+// Deflate compresses at most about 1032:1, a column of more rows than its
+// compressed size allows is corrupt.
+const std::uint64_t max_ratio = 1032;
+
+void put_u16(std::string &out, std::uint16_t value)
+{
+    out.push_back(static_cast<char>(value & 0xff));
+    out.push_back(static_cast<char>(value >> 8));
+}
+
+void put_u32(std::string &out, std::uint32_t value)
+{
+    for (int k = 0; k < 4; ++k)
+        out.push_back(static_cast<char>((value >> (8 * k)) & 0xff));
+}
+
+void put_u64(std::string &out, std::uint64_t value)
+{
+    for (int k = 0; k < 8; ++k)
+        out.push_back(static_cast<char>((value >> (8 * k)) & 0xff));
+}
+
+std::uint64_t get(const unsigned char *p, int bytes)
+{
+    std::uint64_t value = 0;
+    for (int k = 0; k < bytes; ++k)
+        value |= static_cast<std::uint64_t>(p[k]) << (8 * k);
+    return value;
+}
+
+}
+
+RunLogWriter::RunLogWriter(std::size_t chunk_rows)
+    : chunk_rows(chunk_rows ? chunk_rows : 1), columns(run_columns)
+{
+    for (auto &column : columns)
+        column.reserve(this->chunk_rows);
+}
+
+RunLogWriter::~RunLogWriter()
+{
+    close();
+}
+
+bool RunLogWriter::open(const std::string &path)
+{
+    close();
+    file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+
+    std::string header;
+    put_u32(header, magic);
+    put_u16(header, version);
+    put_u16(header, run_columns);
+    for (auto name : run_column_names)
+    {
+        header.push_back(static_cast<char>(std::strlen(name)));
+        header += name;
+    }
+    index.clear();
+    offset = header.size();
+    failed = false;
+    return std::fwrite(header.data(), 1, header.size(), file) == header.size();
+}
+
+bool RunLogWriter::add(const double *row)
+{
+    if (!file)
+        return true;
+    for (int k = 0; k < run_columns; ++k)
+        columns[k].push_back(row[k]);
+    // A chunk that failed to compress is kept and tried again a chunk later.
+    if (columns[0].size() % chunk_rows == 0)
+        return flush();
+    return true;
+}
+
+bool RunLogWriter::flush()
+{
+    const std::size_t rows = columns[0].size();
+    if (rows == 0)
+        return true;
+
+    // Compress the columns after the chunk header.
+    chunk.clear();
+    put_u32(chunk, static_cast<std::uint32_t>(rows));
+    const std::size_t sizes = chunk.size();
+    chunk.append(4 * run_columns, '\0');
+    for (int k = 0; k < run_columns; ++k)
+    {
+        // Bytes of the same significance compress better together.
+        bytes.resize(8 * rows);
+        for (std::size_t i = 0; i < rows; ++i)
+        {
+            std::uint64_t bits;
+            std::memcpy(&bits, &columns[k][i], sizeof(bits));
+            for (int b = 0; b < 8; ++b)
+                bytes[b * rows + i] = static_cast<char>((bits >> (8 * b)) & 0xff);
+        }
+        uLongf size = compressBound(bytes.size());
+        compressed.resize(size);
+        if (compress2(reinterpret_cast<Bytef *>(&compressed[0]), &size,
+                      reinterpret_cast<const Bytef *>(bytes.data()), bytes.size(), Z_BEST_SPEED) != Z_OK)
+            return false;
+        chunk.append(compressed, 0, size);
+
+        std::string encoded;
+        put_u32(encoded, static_cast<std::uint32_t>(size));
+        chunk.replace(sizes + 4 * k, 4, encoded);
+    }
+
+    // The columns stay aligned until every one of them is compressed.
+    for (auto &column : columns)
+        column.clear();
+    index.push_back(offset);
+    offset += chunk.size();
+    if (std::fwrite(chunk.data(), 1, chunk.size(), file) != chunk.size() || std::fflush(file) != 0)
+        failed = true;
+    return !failed;
+}
+
+bool RunLogWriter::close()
+{
+    if (!file)
+        return true;
+
+    bool ok = flush() && !failed;
+    std::string tail;
+    for (auto position : index)
+        put_u64(tail, position);
+    put_u64(tail, offset);
+    put_u32(tail, static_cast<std::uint32_t>(index.size()));
+    put_u32(tail, magic);
+    ok = std::fwrite(tail.data(), 1, tail.size(), file) == tail.size() && ok;
+    ok = std::fclose(file) == 0 && ok;
+    file = nullptr;
+    return ok;
+}
+
+RunLogReader::~RunLogReader()
+{
+    close();
+}
+
+bool RunLogReader::open(const std::string &path)
+{
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat status;
+    if (::fstat(fd, &status) == 0 && status.st_size > 0)
+    {
+        void *p = ::mmap(nullptr, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED)
+        {
+            data = static_cast<const unsigned char *>(p);
+            length = status.st_size;
+        }
+    }
+    ::close(fd);
+    if (!data || length < 8 || get(data, 4) != magic || get(data + 4, 2) != version)
+    {
+        close();
+        return false;
+    }
+
+    std::size_t at = 8;
+    const std::size_t count = get(data + 6, 2);
+    for (std::size_t k = 0; k < count; ++k)
+    {
+        if (at >= length || at + 1 + data[at] > length)
+        {
+            close();
+            return false;
+        }
+        names.emplace_back(reinterpret_cast<const char *>(data + at + 1), data[at]);
+        at += 1 + data[at];
+    }
+
+    // Use the index of a complete log, otherwise walk the chunks.
+    if (length >= at + footer_size && get(data + length - 4, 4) == magic)
+    {
+        const std::uint64_t position = get(data + length - footer_size, 8);
+        const std::uint64_t chunks = get(data + length - 8, 4);
+        if (position + 8 * chunks + footer_size == length)
+        {
+            std::uint64_t next;
+            for (std::uint64_t k = 0; k < chunks; ++k)
+            {
+                if (!read_chunk(get(data + position + 8 * k, 8), next))
+                {
+                    close();
+                    return false;
+                }
+            }
+            return true;
+        }
+    }
+    while (at < length)
+    {
+        std::uint64_t next;
+        if (!read_chunk(at, next))
+            break;
+        at = next;
+    }
+    return true;
+}
+
+bool RunLogReader::read_chunk(std::uint64_t at, std::uint64_t &next)
+{
+    const std::size_t header = 4 + 4 * names.size();
+    if (at + header > length)
+        return false;
+
+    Chunk chunk;
+    chunk.rows = static_cast<std::uint32_t>(get(data + at, 4));
+    next = at + header;
+    for (std::size_t k = 0; k < names.size(); ++k)
+    {
+        chunk.size.push_back(static_cast<std::uint32_t>(get(data + at + 4 + 4 * k, 4)));
+        chunk.offset.push_back(next);
+        next += chunk.size.back();
+        if (std::uint64_t(chunk.rows) * sizeof(double) > max_ratio * chunk.size.back())
+            return false;
+    }
+    if (next > length)
+        return false;
+
+    total_rows += chunk.rows;
+    index.push_back(std::move(chunk));
+    return true;
+}
+
+void RunLogReader::close()
+{
+    if (data)
+        ::munmap(const_cast<unsigned char *>(data), length);
+    data = nullptr;
+    length = 0;
+    names.clear();
+    index.clear();
+    total_rows = 0;
+}
+
+int RunLogReader::column(const std::string &name) const
+{
+    for (std::size_t k = 0; k < names.size(); ++k)
+    {
+        if (names[k] == name)
+            return static_cast<int>(k);
+    }
+    return -1;
+}
+
+bool RunLogReader::read(std::size_t chunk, std::size_t column, std::vector<double> &out) const
+{
+    const auto &entry = index[chunk];
+    uLongf size = entry.rows * sizeof(double);
+    bytes.resize(size);
+    if (uncompress(reinterpret_cast<Bytef *>(&bytes[0]), &size, data + entry.offset[column], entry.size[column]) != Z_OK
+        || size != entry.rows * sizeof(double))
+        return false;
+
+    const std::size_t rows = entry.rows;
+    out.resize(rows);
+    auto p = reinterpret_cast<const unsigned char *>(bytes.data());
+    for (std::size_t i = 0; i < rows; ++i)
+    {
+        std::uint64_t bits = 0;
+        for (int b = 0; b < 8; ++b)
+            bits |= static_cast<std::uint64_t>(p[b * rows + i]) << (8 * b);
+        std::memcpy(&out[i], &bits, sizeof(bits));
+    }
+    return true;
+}
+
+bool read_run(const std::string &path, std::vector<std::vector<double>> &columns)
+{
+    columns.assign(run_columns, std::vector<double>());
+
+    RunLogReader log;
+    if (log.open(path))
+    {
+        std::vector<double> values;
+        for (int k = 0; k < run_columns; ++k)
+        {
+            const int column = log.column(run_column_names[k]);
+            for (std::size_t chunk = 0; chunk < log.chunks(); ++chunk)
+            {
+                if (column < 0)
+                    values.assign(log.rows(chunk), std::numeric_limits<double>::quiet_NaN());
+                else if (!log.read(chunk, column, values))
+                    return false;
+                columns[k].insert(columns[k].end(), values.begin(), values.end());
+            }
+        }
+        return true;
+    }
+
+    std::ifstream file(path);
+    if (!file)
+        return false;
+
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream fields(line);
+        double row[run_columns];
+        int n = 0;
+        while (n < run_columns && fields >> row[n])
+            ++n;
+        std::string rest;
+        if (n < run_columns - 1 || (fields.clear(), fields >> rest))
+            continue;
+        if (n == run_columns - 1)
+            row[run_ref_v] = std::numeric_limits<double>::quiet_NaN();
+        for (int k = 0; k < run_columns; ++k)
+            columns[k].push_back(row[k]);
+    }
+    return true;
+}
+
+long import_run_text(const std::string &input, const std::string &output)
+{
+    std::vector<std::vector<double>> columns;
+    RunLogWriter log;
+    if (!read_run(input, columns) || !log.open(output))
+        return -1;
+
+    const std::size_t count = columns[0].size();
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        double row[run_columns];
+        for (int k = 0; k < run_columns; ++k)
+            row[k] = columns[k][i];
+        if (!log.add(row))
+            return -1;
+    }
+    return log.close() ? static_cast<long>(count) : -1;
+}
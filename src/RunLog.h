@@ -0,0 +1,140 @@
+#ifndef RUNLOG_H
+#define RUNLOG_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Columnar binary log of the controller cycles.
+//
+// The values of a cycle are the columns below, as in the text lines that mpc
+// prints.  Cycles are stored in chunks, and every column of a chunk is a
+// zlib stream of IEEE 754 doubles split into byte planes, the least
+// significant bytes of all values first, the most significant last.
+// Integers are little endian.
+//
+//   file   header chunk* index footer
+//   header u32 magic "MPCL", u16 version, u16 columns, columns * (u8 length, name)
+//   chunk  u32 rows, columns * u32 size, columns * compressed column
+//   index  chunks * u64 offset of the chunk
+//   footer u64 offset of the index, u32 chunks, u32 magic
+//
+// The chunk headers make a log without index readable, e.g. of a killed
+// process, the rows of its unfinished chunk are lost.
+enum RunColumn
+{
+    run_px,       // position in m
+    run_py,
+    run_psi,      // orientation in rad
+    run_v,        // speed in m/s
+    run_cost,     // objective value
+    run_steer,    // steering angle in rad
+    run_throttle, // in [-1, 1]
+    run_ref_v,    // reference speed in m/s, NaN in logs that lack it
+    run_columns
+};
+
+// Names of the columns.
+extern const char *const run_column_names[run_columns];
+
+class RunLogWriter
+{
+public:
+    explicit RunLogWriter(std::size_t chunk_rows = 4096);
+    ~RunLogWriter();
+
+    RunLogWriter(const RunLogWriter &) = delete;
+    RunLogWriter &operator=(const RunLogWriter &) = delete;
+
+    bool open(const std::string &path);
+    bool is_open() const { return file != nullptr; }
+
+    // Append a cycle of run_columns values, false if the chunk it completed
+    // failed to compress or to be written.
+    bool add(const double *row);
+
+    // Write the last chunk and the index, false if any chunk was lost.
+    bool close();
+
+private:
+    bool flush();
+
+    std::FILE *file = nullptr;
+    std::size_t chunk_rows;
+    std::vector<std::vector<double>> columns;
+    std::vector<std::uint64_t> index;
+    std::uint64_t offset = 0;
+    bool failed = false; // a chunk was not written
+    std::string bytes, compressed, chunk;
+};
+
+// Reader of a memory mapped run log.
+class RunLogReader
+{
+public:
+    RunLogReader() = default;
+    ~RunLogReader();
+
+    RunLogReader(const RunLogReader &) = delete;
+    RunLogReader &operator=(const RunLogReader &) = delete;
+
+    // Map the file and read its index, false if it is not a run log.
+    bool open(const std::string &path);
+    void close();
+
+    std::size_t rows() const { return total_rows; }
+    std::size_t chunks() const { return index.size(); }
+    std::size_t rows(std::size_t chunk) const { return index[chunk].rows; }
+    std::size_t columns() const { return names.size(); }
+    const std::string &name(std::size_t column) const { return names[column]; }
+
+    // Column of a name, -1 if the log does not have it.
+    int column(const std::string &name) const;
+
+    // Decompress a column of a chunk into values, reusing their storage.
+    bool read(std::size_t chunk, std::size_t column, std::vector<double> &values) const;
+
+    // Call f(values, count) for the column of every chunk in order.
+    template <typename F>
+    bool scan(std::size_t column, F f) const
+    {
+        for (std::size_t k = 0; k < chunks(); ++k)
+        {
+            if (!read(k, column, values))
+                return false;
+            f(values.data(), values.size());
+        }
+        return true;
+    }
+
+private:
+    struct Chunk
+    {
+        std::uint32_t rows;
+        std::vector<std::uint64_t> offset; // of the columns
+        std::vector<std::uint32_t> size;   // compressed
+    };
+
+    bool read_chunk(std::uint64_t at, std::uint64_t &next);
+
+    const unsigned char *data = nullptr;
+    std::size_t length = 0;
+    std::vector<std::string> names;
+    std::vector<Chunk> index;
+    std::size_t total_rows = 0;
+    mutable std::string bytes;
+    mutable std::vector<double> values;
+};
+
+// Read the cycles of a run log or of the text lines `px py psi v cost steer
+// throttle [ref_v]` printed by mpc, e.g. doc/data/fifth.data, into one
+// vector per column.  Other lines are skipped, missing values are NaN.
+bool read_run(const std::string &path, std::vector<std::vector<double>> &columns);
+
+// Convert the text lines of a run into a run log.  Returns the number of
+// cycles or -1 on errors.
+long import_run_text(const std::string &input, const std::string &output);
+
+#endif /* RUNLOG_H */
@@ -0,0 +1,97 @@
+#include "Session.h"
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+
+Session::Session(const Config &config) : mpc(config), estimator(config)
+{
+    if (!config.get("pipeline", 0))
+        return;
+    try
+    {
+        pipeline.reset(new Pipeline(mpc, config));
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cerr << e.what() << ", the session solves without pipeline" << std::endl;
+    }
+}
+
+void Session::reset()
+{
+    if (pipeline)
+        pipeline->reset();
+    mpc.reset();
+    plan.N = 0;
+    plan.status = PlanStatus::none;
+    estimator.reset();
+    frames = 0;
+    binary = false;
+}
+
+SessionPool::SessionPool(const Config &config) : config(config)
+{
+    const std::size_t count = std::max(0, config.get("sessions", 1));
+    sessions.reserve(count);
+    idle.reserve(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        sessions.emplace_back(new Session(config));
+        idle.push_back(sessions.back().get());
+    }
+}
+
+Session *SessionPool::acquire()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!idle.empty())
+        {
+            Session *session = idle.back();
+            idle.pop_back();
+            return session;
+        }
+    }
+
+    std::unique_ptr<Session> session(new Session(config));
+    std::lock_guard<std::mutex> lock(mutex);
+    sessions.push_back(std::move(session));
+    return sessions.back().get();
+}
+
+void SessionPool::release(Session *session)
+{
+    session->reset();
+    std::lock_guard<std::mutex> lock(mutex);
+    idle.push_back(session);
+}
+
+std::size_t SessionPool::active() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return sessions.size() - idle.size();
+}
+
+std::size_t SessionPool::size() const
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    return sessions.size();
+}
+
+void format_metrics(const std::vector<SessionPool *> &pools, std::string &text)
+{
+    char line[160];
+    text += "# HELP mpc_sessions Controller sessions of open connections and idle ones.\n"
+            "# TYPE mpc_sessions gauge\n";
+    for (std::size_t i = 0; i < pools.size(); ++i)
+    {
+        if (pools[i] == nullptr)
+            continue;
+        const std::size_t active = pools[i]->active(), size = pools[i]->size();
+        std::snprintf(line, sizeof(line),
+                      "mpc_sessions{thread=\"%zu\",state=\"active\"} %zu\nmpc_sessions{thread=\"%zu\",state=\"idle\"} %zu\n",
+                      i, active, i, size - active);
+        text += line;
+    }
+}
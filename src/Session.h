@@ -0,0 +1,90 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "Arena.h"
+#include "Config.h"
+#include "Latency.h"
+#include "MPC.h"
+#include "Pipeline.h"
+#include "Plan.h"
+#include "Protocol.h"
+#include "Telemetry.h"
+
+// Controller of one vehicle, kept for every websocket connection.
+//
+// Each simulator gets its own commands in flight, latency estimate and
+// speculative solves, so connections do not disturb each other.
+struct Session
+{
+    // Reads the options of MPC, LatencyEstimator and, if `pipeline` is 1,
+    // Pipeline, which is left out if no CppAD thread number is left for it.
+    explicit Session(const Config &config);
+
+    Session(const Session &) = delete;
+    Session &operator=(const Session &) = delete;
+
+    // Back to the state of a new connection, the buffers keep their storage.
+    void reset();
+
+    MPC mpc;
+    Plan plan;                          // last plan, the start of the speculative solve
+    LatencyEstimator estimator;         // delay from the arrival of a frame to its reply
+    std::unique_ptr<Pipeline> pipeline; // speculative solves of the next frame
+    std::size_t frames = 0;             // telemetry frames replied to
+
+    bool binary = false; // the binary protocol was negotiated
+    Arena arena;         // JSON documents of the current frame
+    Telemetry telemetry; // last telemetry, its vectors are reused
+    CarFrame frame;      // telemetry in the vehicle coordinate system, reused
+    Steer steer;         // last reply, its vectors are reused
+    std::string buffer;  // input of the telemetry parser
+    std::string message; // encoded reply
+};
+
+// Sessions of the open connections and idle ones for the next connections.
+//
+// A controller takes a solver workspace and a pipeline takes a thread, so
+// sessions are reset and kept when their connection closes instead of
+// being destroyed.  The pool grows to the peak number of connections.
+//
+// A pool belongs to the thread of one event loop.  Its lock only guards the
+// lists against the metrics of other threads, sessions are created and
+// reset outside of it.
+class SessionPool
+{
+public:
+    // Create `sessions` idle sessions ahead of the first connections.
+    explicit SessionPool(const Config &config);
+
+    SessionPool(const SessionPool &) = delete;
+    SessionPool &operator=(const SessionPool &) = delete;
+
+    // Session for a new connection.
+    Session *acquire();
+
+    // Reset the session of a closed connection and keep it.
+    void release(Session *session);
+
+    // Sessions of open connections and all sessions.
+    std::size_t active() const;
+    std::size_t size() const;
+
+private:
+    Config config;
+    mutable std::mutex mutex;
+    std::vector<std::unique_ptr<Session>> sessions;
+    std::vector<Session *> idle;
+};
+
+// Append the number of active and idle sessions of the pool of every
+// server thread, labelled with its index, in the Prometheus text exposition
+// format.  Pools of threads that are not running are null, the caller
+// keeps them from being destroyed meanwhile.
+void format_metrics(const std::vector<SessionPool *> &pools, std::string &text);
+
+#endif /* SESSION_H */
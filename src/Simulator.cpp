@@ -0,0 +1,178 @@
+#include "Simulator.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+#include "MPC.h"
+#include "Pipeline.h"
+
+Simulator::Simulator(const Track &track, const Config &config)
+    : track(track), model_type(make_model_type(config.get("sim.model", "dynamic"))),
+      step(config.get("sim.step", 1e-3)),
+      latency(config.get("sim.latency", config.get("latency", 0.1))),
+      throttle_gain(config.get("sim.throttle_gain", 1.)),
+      noise_position(config.get("sim.noise_position", 0.)),
+      noise_heading(config.get("sim.noise_heading", 0.)),
+      noise_speed(config.get("sim.noise_speed", 0.)),
+      noise_steer(config.get("sim.noise_steer", 0.)),
+      random(config.get("sim.seed", 1))
+{
+    reset();
+}
+
+void Simulator::reset(double at)
+{
+    double px, py, heading;
+    track.pose(at, px, py, heading);
+    std::fill(state, state + DynamicModel::n_states, 0.);
+    state[KinematicModel::x] = px;
+    state[KinematicModel::y] = py;
+    state[KinematicModel::psi] = heading;
+
+    delta = a = 0.;
+    commands.clear();
+    t = 0.;
+    distance = 0.;
+    last_at = track.project(px, py, error);
+}
+
+void Simulator::telemetry(Telemetry &telemetry)
+{
+    std::normal_distribution<double> normal;
+    telemetry.x = state[KinematicModel::x] + noise_position * normal(random);
+    telemetry.y = state[KinematicModel::y] + noise_position * normal(random);
+
+    // The simulator sends the orientation in [0, 2 pi).
+    double psi = std::fmod(state[KinematicModel::psi] + noise_heading * normal(random), 2. * M_PI);
+    telemetry.psi = psi < 0. ? psi + 2. * M_PI : psi;
+
+    double v = state[KinematicModel::v] + noise_speed * normal(random);
+    telemetry.speed = v * 3600. / 1609.34; // in mph
+
+    track.waypoints(state[KinematicModel::x], state[KinematicModel::y], 6, telemetry.ptsx, telemetry.ptsy);
+}
+
+void Simulator::actuate(double delta, double a)
+{
+    std::normal_distribution<double> normal;
+    commands.push_back(Command{t + latency, delta + noise_steer * normal(random), a});
+}
+
+void Simulator::advance(double duration)
+{
+    const double end = t + duration;
+    while (t < end - 1e-12)
+    {
+        while (!commands.empty() && commands.front().time <= t + 1e-12)
+        {
+            delta = commands.front().delta;
+            a = commands.front().a;
+            commands.pop_front();
+        }
+        integrate(std::min(step, end - t));
+    }
+
+    // Unwrap the progress over the end of the lap.
+    double at = track.project(state[KinematicModel::x], state[KinematicModel::y], error);
+    double change = at - last_at;
+    if (change > track.length() / 2.)
+        change -= track.length();
+    else if (change < -track.length() / 2.)
+        change += track.length();
+    distance += change;
+    last_at = at;
+}
+
+void Simulator::integrate(double h)
+{
+    const int n = DynamicModel::n_states;
+    const double max_delta = deg2rad(25);
+    double u[2] = {std::max(-max_delta, std::min(max_delta, delta)),
+                   std::max(-1., std::min(1., a)) * throttle_gain};
+    double k1[n] = {}, k2[n] = {}, k3[n] = {}, k4[n] = {}, tmp[n] = {};
+
+    auto derivatives = [this, &u](const double *s, double *ds) {
+        if (model_type == ModelType::dynamic)
+            dynamic_model.derivatives(s, u, ds);
+        else
+            kinematic_model.derivatives(s, u, ds);
+    };
+
+    derivatives(state, k1);
+    for (int k = 0; k < n; ++k)
+        tmp[k] = state[k] + k1[k] * h / 2.;
+    derivatives(tmp, k2);
+    for (int k = 0; k < n; ++k)
+        tmp[k] = state[k] + k2[k] * h / 2.;
+    derivatives(tmp, k3);
+    for (int k = 0; k < n; ++k)
+        tmp[k] = state[k] + k3[k] * h;
+    derivatives(tmp, k4);
+    for (int k = 0; k < n; ++k)
+        state[k] += (k1[k] + 2. * k2[k] + 2. * k3[k] + k4[k]) * h / 6.;
+
+    // The vehicle does not drive backwards when braking.
+    state[KinematicModel::v] = std::max(0., state[KinematicModel::v]);
+    t += h;
+}
+
+SimResult simulate(const Track &track, const Config &config)
+{
+    const double period = config.get("sim.period", 0.1);
+    const double max_time = config.get("sim.max_time", 300.);
+    const double max_cte = config.get("sim.max_cte", 4.);
+
+    Simulator simulator(track, config);
+    simulator.reset(config.get("sim.start", 0.));
+
+    MPC mpc(config);
+    mpc.clock = [&simulator] { return simulator.time(); };
+    std::unique_ptr<Pipeline> pipeline;
+    if (config.get("pipeline", 0))
+        pipeline.reset(new Pipeline(mpc, config));
+    Plan plan;
+    Telemetry telemetry;
+    CarFrame frame;
+
+    SimResult result;
+    double sum_cte = 0., sum_speed = 0.;
+    while (simulator.time() < max_time)
+    {
+        simulator.telemetry(telemetry);
+        to_car_frame(telemetry, frame);
+        auto start = std::chrono::steady_clock::now();
+        bool ok = pipeline ? pipeline->Solve(telemetry, frame, plan)
+                  : mpc.Solve(frame.state, frame.coeffs, frame.x_vals.front(), frame.x_vals.back(), plan);
+        if (!ok)
+            ++result.failures;
+        result.solve_time.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        simulator.actuate(plan.delta, plan.a);
+        if (pipeline)
+            pipeline->speculate(telemetry, plan);
+        simulator.advance(period);
+
+        ++result.cycles;
+        result.max_cte = std::max(result.max_cte, std::fabs(simulator.cte()));
+        sum_cte += std::fabs(simulator.cte());
+        sum_speed += simulator.speed();
+
+        if (std::fabs(simulator.cte()) > max_cte)
+            break;
+        if (simulator.progress() >= track.length())
+        {
+            result.completed = true;
+            break;
+        }
+    }
+
+    result.lap_time = simulator.time();
+    result.progress = simulator.progress();
+    if (pipeline)
+        result.accepted = pipeline->accepted;
+    if (result.cycles)
+    {
+        result.mean_cte = sum_cte / result.cycles;
+        result.mean_speed = sum_speed / result.cycles;
+    }
+    return result;
+}
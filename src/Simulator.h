@@ -0,0 +1,93 @@
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <cstddef>
+#include <deque>
+#include <random>
+#include <vector>
+#include "Config.h"
+#include "Model.h"
+#include "Telemetry.h"
+#include "Track.h"
+
+// Headless replacement of the simulator.
+//
+// The vehicle is integrated with RK4 at a fixed step with the dynamic or
+// the kinematic bicycle model of the controller.  Actuations are applied
+// after a latency and the telemetry is generated from the track as the
+// simulator sends it, optionally with Gaussian noise.
+class Simulator
+{
+public:
+    // Reads `sim.model`, `sim.step`, `sim.latency` (defaults to `latency`),
+    // `sim.throttle_gain`, the noise deviations `sim.noise_*` and `sim.seed`.
+    Simulator(const Track &track, const Config &config);
+
+    // Place the vehicle at rest on the center line at the arc length `at`.
+    void reset(double at = 0.);
+
+    // Telemetry of the current state.
+    void telemetry(Telemetry &telemetry);
+
+    // Send actuations, the steering angle in rad positive to the left and
+    // the throttle in [-1, 1].  They are applied after the latency.
+    void actuate(double delta, double a);
+
+    // Advance the simulation by duration in s.
+    void advance(double duration);
+
+    double time() const { return t; }
+    double progress() const { return distance; } // along the center line in m
+    double cte() const { return error; }         // distance to the center line in m, positive on the left
+    double speed() const { return state[KinematicModel::v]; }
+    const double *pose() const { return state; } // x, y, psi, v, ...
+
+private:
+    struct Command
+    {
+        double time, delta, a;
+    };
+
+    void integrate(double h);
+
+    const Track &track;
+    ModelType model_type;
+    KinematicModel kinematic_model;
+    DynamicModel dynamic_model;
+
+    double step;          // integration step in s
+    double latency;       // of the actuations in s
+    double throttle_gain; // acceleration at full throttle in m/s^2
+    double noise_position, noise_heading, noise_speed, noise_steer;
+    std::mt19937 random;
+
+    double state[DynamicModel::n_states];
+    double delta = 0., a = 0.; // applied actuations
+    std::deque<Command> commands;
+
+    double t = 0.;
+    double distance = 0., last_at = 0., error = 0.;
+};
+
+// Outcome of a closed loop run of the controller on the track.
+struct SimResult
+{
+    bool completed = false;   // a lap was driven without leaving the track
+    double lap_time = 0.;     // simulated time in s
+    double progress = 0.;     // along the center line in m
+    double max_cte = 0.;      // in m
+    double mean_cte = 0.;     // mean absolute cross track error in m
+    double mean_speed = 0.;   // in m/s
+    std::size_t cycles = 0;   // controller cycles
+    std::size_t failures = 0; // cycles where the solver failed
+    std::size_t accepted = 0; // cycles that used the speculative plan with `pipeline`
+    std::vector<double> solve_time; // wall time of the solve of each cycle in s
+};
+
+// Drive one lap with the controller configured by config, which also holds
+// the simulator options, `sim.period` between the cycles, `sim.max_time`
+// and `sim.max_cte` where the vehicle has left the track.  With `pipeline`
+// the next cycle is solved speculatively while the simulation advances.
+SimResult simulate(const Track &track, const Config &config);
+
+#endif /* SIMULATOR_H */
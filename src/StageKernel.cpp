@@ -0,0 +1,92 @@
+#include "StageKernel.h"
+#include <cassert>
+#include <cstdint>
+#include "FastMath.h"
+
+namespace
+{
+
+const std::size_t cache_line = 64;
+const std::size_t n_columns = 2 * KinematicModel::n_states + 7 + KinematicStages::n_partials;
+
+}
+
+KinematicStages::KinematicStages(std::size_t count)
+{
+    resize(count);
+}
+
+void KinematicStages::resize(std::size_t count)
+{
+    this->count = count;
+    const std::size_t stride = (count + lane_block - 1) / lane_block * lane_block;
+    storage.assign(n_columns * stride + cache_line / sizeof(double), 0.);
+
+    auto address = reinterpret_cast<std::uintptr_t>(storage.data());
+    double *column = storage.data() + (cache_line - address % cache_line) % cache_line / sizeof(double);
+    auto take = [&column, stride] {
+        double *taken = column;
+        column += stride;
+        return taken;
+    };
+
+    for (auto &values : state)
+        values = take();
+    delta = take();
+    a = take();
+    dt = take();
+    for (auto &values : coeffs)
+        values = take();
+    for (auto &values : next)
+        values = take();
+    for (auto &values : partial)
+        values = take();
+}
+
+void KinematicStages::evaluate(const KinematicModel &model, std::size_t begin, std::size_t end)
+{
+    using namespace fast;
+    typedef KinematicModel M;
+    assert(begin % lane_block == 0 && end <= count);
+
+    const Pack inverse_Lf(1. / model.Lf);
+    for (std::size_t i = begin; i < end; i += Pack::size)
+    {
+        const Pack x = Pack::load(state[M::x] + i), y = Pack::load(state[M::y] + i);
+        const Pack psi = Pack::load(state[M::psi] + i), v = Pack::load(state[M::v] + i);
+        const Pack epsi = Pack::load(state[M::epsi] + i);
+        const Pack u_delta = Pack::load(delta + i), u_a = Pack::load(a + i), h = Pack::load(dt + i);
+        const Pack c0 = Pack::load(coeffs[0] + i), c1 = Pack::load(coeffs[1] + i);
+        const Pack c2 = Pack::load(coeffs[2] + i), c3 = Pack::load(coeffs[3] + i);
+
+        Pack sin_psi, cos_psi, sin_epsi, cos_epsi;
+        sincos(psi, sin_psi, cos_psi);
+        sincos(epsi, sin_epsi, cos_epsi);
+
+        // Reference line, its slope and the derivative of the slope at x.
+        const Pack f = fma(fma(fma(c3, x, c2), x, c1), x, c0);
+        const Pack slope = fma(fma(Pack(3.) * c3, x, Pack(2.) * c2), x, c1);
+        const Pack bend = fma(Pack(6.) * c3, x, Pack(2.) * c2);
+
+        const Pack distance = v * h;
+        const Pack turn = distance * u_delta * inverse_Lf;
+        fma(distance, cos_psi, x).store(next[M::x] + i);
+        fma(distance, sin_psi, y).store(next[M::y] + i);
+        (psi + turn).store(next[M::psi] + i);
+        fma(u_a, h, v).store(next[M::v] + i);
+        fma(distance, sin_epsi, f - y).store(next[M::cte] + i);
+        (psi - atan(slope) + turn).store(next[M::epsi] + i);
+
+        (-distance * sin_psi).store(partial[x_psi] + i);
+        (h * cos_psi).store(partial[x_v] + i);
+        (distance * cos_psi).store(partial[y_psi] + i);
+        (h * sin_psi).store(partial[y_v] + i);
+        (h * u_delta * inverse_Lf).store(partial[psi_v] + i);
+        (distance * inverse_Lf).store(partial[psi_delta] + i);
+        h.store(partial[v_a] + i);
+        slope.store(partial[cte_x] + i);
+        (h * sin_epsi).store(partial[cte_v] + i);
+        (distance * cos_epsi).store(partial[cte_epsi] + i);
+        (-bend / fma(slope, slope, Pack(1.))).store(partial[epsi_x] + i);
+    }
+}
@@ -0,0 +1,53 @@
+#ifndef STAGEKERNEL_H
+#define STAGEKERNEL_H
+
+#include <cstddef>
+#include <vector>
+#include "Model.h"
+
+// Explicit Euler transitions of the kinematic model and their partial
+// derivatives for a batch of lanes in structure of arrays layout, e.g. the
+// stages of a horizon or the first stages of the problems of many vehicles.
+//
+// The lanes are evaluated a pack of FastMath.h at a time.  Every column is
+// aligned to a cache line and padded to a multiple of lane_block lanes, so
+// ranges of lanes that start at multiples of lane_block can be evaluated
+// on different threads.
+class KinematicStages
+{
+public:
+    enum { lane_block = 8 }; // lanes of a cache line
+
+    // Partial derivatives of the predicted states that depend on the lane,
+    // e.g. x_psi is d x1 / d psi0.  The other ones are 0 or 1, except for
+    // d cte1 / d y0 = -1, and d epsi1 / d v0, d epsi1 / d delta are those of psi.
+    enum Partial { x_psi, x_v, y_psi, y_v, psi_v, psi_delta, v_a, cte_x, cte_v, cte_epsi, epsi_x, n_partials };
+
+    explicit KinematicStages(std::size_t count = 0);
+
+    KinematicStages(const KinematicStages &) = delete;
+    KinematicStages &operator=(const KinematicStages &) = delete;
+
+    // Change the number of lanes, the values are lost.
+    void resize(std::size_t count);
+    std::size_t size() const { return count; }
+
+    // Inputs of the lanes: the states at the beginning of the stage, the
+    // actuations, the stage duration and the reference line polynomial.
+    double *state[KinematicModel::n_states];
+    double *delta, *a, *dt;
+    double *coeffs[4];
+
+    // Outputs: the states at the end of the stage and the partial derivatives.
+    double *next[KinematicModel::n_states];
+    double *partial[n_partials];
+
+    // Evaluate the lanes in [begin, end), begin is a multiple of lane_block.
+    void evaluate(const KinematicModel &model, std::size_t begin, std::size_t end);
+
+private:
+    std::size_t count = 0;
+    std::vector<double> storage;
+};
+
+#endif /* STAGEKERNEL_H */
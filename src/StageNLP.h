@@ -0,0 +1,427 @@
+#ifndef STAGENLP_H
+#define STAGENLP_H
+
+#include <coin/IpTNLP.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+#include "Eigen-3.3/unsupported/Eigen/AutoDiff"
+#include "Cost.h"
+#include "MPC.h"
+#include "Model.h"
+#include "StageKernel.h"
+#include "ThreadPool.h"
+
+namespace Eigen
+{
+
+// The AutoDiff module has no atan, which reference_angle needs.
+template <typename DerType>
+AutoDiffScalar<typename internal::remove_all<DerType>::type::PlainObject> atan(const AutoDiffScalar<DerType> &x)
+{
+    using std::atan;
+    typedef typename internal::remove_all<DerType>::type::PlainObject Derivatives;
+    const double value = x.value();
+    return AutoDiffScalar<Derivatives>(atan(value), x.derivatives() / (1. + value * value));
+}
+
+}
+
+// The horizon as an Ipopt problem with derivatives of forward mode
+// AutoDiffScalar on the stack instead of a CppAD tape.
+//
+// Every stage transition only depends on the states and actuations of its
+// stage, so its Jacobian block is computed with a fixed size derivative
+// vector over those n_states + 2 variables, the next state enters the
+// constraint linearly with a unit coefficient.  The cost terms of a stage
+// are differentiated the same way over the state, the actuations and the
+// actuations of the previous block.  The blocks are assembled into the
+// sparse Jacobian and gradient that Ipopt asks for, the Hessian of the
+// Lagrangian is left to the limited memory quasi-Newton approximation of
+// Ipopt.
+//
+// The constraints are in the order of FG_eval without its objective entry.
+//
+// The transitions do not depend on each other, with a pool they are split
+// into one contiguous range of stages per worker.  Every stage writes its
+// residuals and Jacobian block to its own record, padded to whole cache
+// lines, so the workers never write to the same line, and eval_g and
+// eval_jac_g gather the records.
+//
+// The Euler transitions of the kinematic model have hand written
+// derivatives: the stages are copied to a KinematicStages batch that
+// evaluates them a SIMD pack at a time.  The ranges of the workers start
+// at multiples of its lane block then.
+template <typename Model>
+class StageNLP : public Ipopt::TNLP
+{
+public:
+    typedef Ipopt::Index Index;
+    typedef Ipopt::Number Number;
+
+    StageNLP(const Layout &layout, const Model &model, Integrator integrator, const Cost &cost)
+        : solution(layout.n_vars), layout(layout), model(model), integrator(integrator), cost(cost),
+          records((layout.N - 1) * record_size + cache_line / sizeof(double)), gradient(layout.n_vars)
+    {
+        // Align the first record to a cache line.
+        auto address = reinterpret_cast<std::uintptr_t>(records.data());
+        first_record = records.data() + (cache_line - address % cache_line) % cache_line / sizeof(double);
+
+        if (std::is_same<Model, KinematicModel>::value && integrator == Integrator::euler)
+            kernel.reset(new KinematicStages(layout.N - 1));
+
+        evaluate_part = [this](std::size_t part, std::size_t) {
+            const std::size_t stages = this->layout.N - 1;
+            evaluate_stages(std::min(stages, part * lane_blocks() / parts() * KinematicStages::lane_block),
+                            std::min(stages, (part + 1) * lane_blocks() / parts() * KinematicStages::lane_block));
+        };
+    }
+
+    // Problem of the next solve, the arrays have the sizes of the layout.
+    Eigen::VectorXd coeffs;
+    double ref_v = 0.;
+    const double *start = nullptr;
+    const double *vars_lowerbound = nullptr, *vars_upperbound = nullptr;
+    const double *constraints_lowerbound = nullptr, *constraints_upperbound = nullptr;
+
+    // Result of the last solve.
+    std::vector<double> solution;
+    double objective = 0.;
+    Ipopt::SolverReturn status = Ipopt::UNASSIGNED;
+
+    // Workers of the transitions, nullptr to evaluate them on the calling thread.
+    ThreadPool *pool = nullptr;
+
+    // Evaluate the kinematic Euler transitions with KinematicStages,
+    // otherwise with AutoDiffScalar as the other ones.
+    bool vectorize = true;
+
+    bool get_nlp_info(Index &n, Index &m, Index &nnz_jac_g, Index &nnz_h_lag, IndexStyleEnum &index_style) override
+    {
+        n = layout.n_vars;
+        m = layout.n_constraints;
+        nnz_jac_g = jacobian_size();
+        nnz_h_lag = 0;
+        index_style = C_STYLE;
+        return true;
+    }
+
+    bool get_bounds_info(Index n, Number *x_l, Number *x_u, Index m, Number *g_l, Number *g_u) override
+    {
+        std::copy(vars_lowerbound, vars_lowerbound + n, x_l);
+        std::copy(vars_upperbound, vars_upperbound + n, x_u);
+        std::copy(constraints_lowerbound, constraints_lowerbound + m, g_l);
+        std::copy(constraints_upperbound, constraints_upperbound + m, g_u);
+        return true;
+    }
+
+    bool get_starting_point(Index n, bool init_x, Number *x, bool, Number *, Number *, Index, bool, Number *) override
+    {
+        if (init_x)
+            std::copy(start, start + n, x);
+        return true;
+    }
+
+    bool eval_f(Index, const Number *x, bool new_x, Number &obj_value) override
+    {
+        evaluate_cost(x, new_x);
+        obj_value = cost_value;
+        return true;
+    }
+
+    bool eval_grad_f(Index n, const Number *x, bool new_x, Number *grad_f) override
+    {
+        evaluate_cost(x, new_x);
+        std::copy(gradient.begin(), gradient.end(), grad_f);
+        return true;
+    }
+
+    bool eval_g(Index, const Number *x, bool new_x, Index, Number *values) override
+    {
+        evaluate_constraints(x, new_x);
+        const auto N = layout.N;
+        for (int k = 0; k < n_states; ++k)
+            values[layout.x_start + k * N] = x[layout.x_start + k * N];
+        for (std::size_t i = 0; i + 1 < N; ++i)
+        {
+            const double *record = first_record + i * record_size;
+            for (int k = 0; k < n_states; ++k)
+                values[layout.x_start + k * N + i + 1] = record[k];
+        }
+        return true;
+    }
+
+    bool eval_jac_g(Index, const Number *x, bool new_x, Index, Index, Index *iRow, Index *jCol, Number *values) override
+    {
+        if (values == nullptr)
+        {
+            structure(iRow, jCol);
+            return true;
+        }
+        evaluate_constraints(x, new_x);
+        std::fill(values, values + n_states, 1.);
+        values += n_states;
+        for (std::size_t i = 0; i + 1 < layout.N; ++i, values += block_size)
+        {
+            const double *record = first_record + i * record_size + n_states;
+            std::copy(record, record + block_size, values);
+        }
+        return true;
+    }
+
+    void finalize_solution(Ipopt::SolverReturn status, Index n, const Number *x, const Number *, const Number *,
+                           Index, const Number *, const Number *, Number obj_value,
+                           const Ipopt::IpoptData *, Ipopt::IpoptCalculatedQuantities *) override
+    {
+        this->status = status;
+        objective = obj_value;
+        solution.assign(x, x + n);
+    }
+
+private:
+    enum { n_states = Model::n_states };
+    typedef Eigen::AutoDiffScalar<Eigen::Matrix<double, n_states + 2, 1>> StageScalar;
+    typedef Eigen::AutoDiffScalar<Eigen::Matrix<double, n_states + 4, 1>> CostScalar;
+
+    // A record holds the residuals of a stage followed by its Jacobian block.
+    enum { cache_line = 64 };
+    enum { block_size = n_states * (n_states + 3) };
+    enum { line_size = cache_line / sizeof(double) };
+    enum { record_size = (n_states + block_size + line_size - 1) / line_size * line_size };
+
+    std::size_t jacobian_size() const
+    {
+        return n_states + (layout.N - 1) * block_size;
+    }
+
+    // Rows and columns of the Jacobian entries: the initial states, then for
+    // every stage and state the current states, the actuations and the next state.
+    void structure(Index *row, Index *column) const
+    {
+        const auto N = layout.N;
+        std::size_t e = 0;
+        for (int k = 0; k < n_states; ++k, ++e)
+            row[e] = column[e] = layout.x_start + k * N;
+
+        for (std::size_t i = 0; i + 1 < N; ++i)
+        {
+            for (int k = 0; k < n_states; ++k)
+            {
+                const Index r = layout.x_start + k * N + i + 1;
+                for (int j = 0; j < n_states; ++j, ++e)
+                {
+                    row[e] = r;
+                    column[e] = layout.x_start + j * N + i;
+                }
+                row[e] = r;
+                column[e++] = layout.delta_start + layout.block[i];
+                row[e] = r;
+                column[e++] = layout.a_start + layout.block[i];
+                row[e] = r;
+                column[e++] = r;
+            }
+        }
+    }
+
+    void evaluate_constraints(const Number *x, bool new_x)
+    {
+        if (new_x)
+            constraints_valid = cost_valid = false;
+        if (constraints_valid)
+            return;
+        constraints_valid = true;
+
+        current_x = x;
+        const std::size_t stages = layout.N - 1;
+        if (pool && parts() > 1)
+            pool->run(parts(), evaluate_part);
+        else
+            evaluate_stages(0, stages);
+    }
+
+    // The workers get whole blocks of lanes, so the records and the
+    // columns of the kernel they write never share a cache line.
+    std::size_t lane_blocks() const
+    {
+        return (layout.N - 1 + KinematicStages::lane_block - 1) / KinematicStages::lane_block;
+    }
+
+    std::size_t parts() const
+    {
+        return std::min(pool->size(), lane_blocks());
+    }
+
+    // Residuals and Jacobian blocks of the transitions from the stages in [begin, end).
+    void evaluate_stages(std::size_t begin, std::size_t end)
+    {
+        if (kernel && vectorize)
+        {
+            evaluate_kernel(begin, end);
+            return;
+        }
+
+        const Number *x = current_x;
+        const auto N = layout.N;
+        const int nd = n_states + 2;
+
+        StageScalar s0[n_states], u[Model::n_inputs], predicted[n_states];
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            for (int k = 0; k < n_states; ++k)
+                s0[k] = StageScalar(x[layout.x_start + k * N + i], nd, k);
+            u[Model::delta] = StageScalar(x[layout.delta_start + layout.block[i]], nd, n_states);
+            u[Model::a] = StageScalar(x[layout.a_start + layout.block[i]], nd, n_states + 1);
+
+            transition(model, integrator, coeffs, s0, u, layout.dt[i], predicted);
+
+            double *record = first_record + i * record_size;
+            double *block = record + n_states;
+            for (int k = 0; k < n_states; ++k)
+            {
+                record[k] = x[layout.x_start + k * N + i + 1] - predicted[k].value();
+                const auto &derivatives = predicted[k].derivatives();
+                for (int j = 0; j < nd; ++j)
+                    *block++ = -derivatives[j];
+                *block++ = 1.;
+            }
+        }
+    }
+
+    // Residuals and Jacobian blocks from the kernel, the rows of a block
+    // are the negated partial derivatives of the kinematic states and the
+    // unit coefficient of the next state.
+    void evaluate_kernel(std::size_t begin, std::size_t end)
+    {
+        typedef KinematicModel M;
+        typedef KinematicStages K;
+        const Number *x = current_x;
+        const auto N = layout.N;
+        auto &stages = *kernel;
+
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            for (int k = 0; k < n_states; ++k)
+                stages.state[k][i] = x[layout.x_start + k * N + i];
+            stages.delta[i] = x[layout.delta_start + layout.block[i]];
+            stages.a[i] = x[layout.a_start + layout.block[i]];
+            stages.dt[i] = layout.dt[i];
+            for (int j = 0; j < 4; ++j)
+                stages.coeffs[j][i] = coeffs[j];
+        }
+
+        evaluate_lanes(stages, model, begin, end);
+
+        const int row = n_states + 3, u = n_states;
+        for (std::size_t i = begin; i < end; ++i)
+        {
+            double *record = first_record + i * record_size;
+            for (int k = 0; k < n_states; ++k)
+                record[k] = x[layout.x_start + k * N + i + 1] - stages.next[k][i];
+
+            double *block = record + n_states;
+            std::fill(block, block + block_size, 0.);
+            auto entry = [block, row](int state, int column) -> double & { return block[state * row + column]; };
+            auto partial = [&stages, i](K::Partial p) { return stages.partial[p][i]; };
+            for (int k = 0; k < n_states; ++k)
+                entry(k, row - 1) = 1.;
+
+            entry(M::x, M::x) = -1.;
+            entry(M::x, M::psi) = -partial(K::x_psi);
+            entry(M::x, M::v) = -partial(K::x_v);
+            entry(M::y, M::y) = -1.;
+            entry(M::y, M::psi) = -partial(K::y_psi);
+            entry(M::y, M::v) = -partial(K::y_v);
+            entry(M::psi, M::psi) = -1.;
+            entry(M::psi, M::v) = -partial(K::psi_v);
+            entry(M::psi, u + M::delta) = -partial(K::psi_delta);
+            entry(M::v, M::v) = -1.;
+            entry(M::v, u + M::a) = -partial(K::v_a);
+            entry(M::cte, M::x) = -partial(K::cte_x);
+            entry(M::cte, M::y) = 1.;
+            entry(M::cte, M::v) = -partial(K::cte_v);
+            entry(M::cte, M::epsi) = -partial(K::cte_epsi);
+            entry(M::epsi, M::x) = -partial(K::epsi_x);
+            entry(M::epsi, M::psi) = -1.;
+            entry(M::epsi, M::v) = -partial(K::psi_v);
+            entry(M::epsi, u + M::delta) = -partial(K::psi_delta);
+        }
+    }
+
+    // The kernel only exists for the kinematic model.
+    static void evaluate_lanes(KinematicStages &stages, const KinematicModel &model, std::size_t begin, std::size_t end)
+    {
+        stages.evaluate(model, begin, end);
+    }
+    static void evaluate_lanes(KinematicStages &, const DynamicModel &, std::size_t, std::size_t) {}
+
+    void evaluate_cost(const Number *x, bool new_x)
+    {
+        if (new_x)
+            constraints_valid = cost_valid = false;
+        if (cost_valid)
+            return;
+        cost_valid = true;
+
+        const auto N = layout.N;
+        const int nd = n_states + 4;
+        cost_value = 0.;
+        std::fill(gradient.begin(), gradient.end(), 0.);
+
+        CostScalar state[n_states], input[2], previous[2];
+        for (std::size_t i = 0; i < N; ++i)
+        {
+            std::size_t index[n_states + 4];
+            for (int k = 0; k < n_states; ++k)
+            {
+                index[k] = layout.x_start + k * N + i;
+                state[k] = CostScalar(x[index[k]], nd, k);
+            }
+
+            StageVars<CostScalar> stage{i, N - 1, state, nullptr, nullptr, ref_v};
+            int used = n_states;
+            if (i < N - 1)
+            {
+                index[n_states] = layout.delta_start + layout.block[i];
+                index[n_states + 1] = layout.a_start + layout.block[i];
+                input[0] = CostScalar(x[index[n_states]], nd, n_states);
+                input[1] = CostScalar(x[index[n_states + 1]], nd, n_states + 1);
+                stage.input = input;
+                used += 2;
+            }
+            if (0 < i && i < N - 1 && layout.block[i] != layout.block[i - 1])
+            {
+                index[n_states + 2] = layout.delta_start + layout.block[i - 1];
+                index[n_states + 3] = layout.a_start + layout.block[i - 1];
+                previous[0] = CostScalar(x[index[n_states + 2]], nd, n_states + 2);
+                previous[1] = CostScalar(x[index[n_states + 3]], nd, n_states + 3);
+                stage.previous = previous;
+                used += 2;
+            }
+
+            CostScalar f(0.);
+            cost.add(f, stage);
+            cost_value += f.value();
+            for (int j = 0; j < used; ++j)
+                gradient[index[j]] += f.derivatives()[j];
+        }
+    }
+
+    const Layout &layout;
+    const Model &model;
+    Integrator integrator;
+    const Cost &cost;
+
+    std::vector<double> records, gradient;
+    double *first_record;
+    const Number *current_x = nullptr;
+    std::function<void(std::size_t, std::size_t)> evaluate_part;
+    std::unique_ptr<KinematicStages> kernel;
+    double cost_value = 0.;
+    bool constraints_valid = false, cost_valid = false;
+};
+
+#endif /* STAGENLP_H */
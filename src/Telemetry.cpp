@@ -0,0 +1,97 @@
+#include "Telemetry.h"
+#include <cassert>
+#include <cmath>
+#include "Eigen-3.3/Eigen/QR"
+
+double polyeval(const Eigen::VectorXd &coeffs, double x)
+{
+    double result = 0.0;
+    for (int i = 0; i < coeffs.size(); i++)
+    {
+        result += coeffs[i] * pow(x, i);
+    }
+    return result;
+}
+
+// Adapted from
+// https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
+Eigen::VectorXd polyfit(const Eigen::VectorXd &xvals, const Eigen::VectorXd &yvals, int order)
+{
+    assert(xvals.size() == yvals.size());
+    assert(order >= 1 && order <= xvals.size() - 1);
+    Eigen::MatrixXd A(xvals.size(), order + 1);
+
+    for (int i = 0; i < xvals.size(); i++)
+    {
+        A(i, 0) = 1.0;
+    }
+
+    for (int j = 0; j < xvals.size(); j++)
+    {
+        for (int i = 0; i < order; i++) {
+            A(j, i + 1) = A(j, i) * xvals(j);
+        }
+    }
+
+    auto Q = A.householderQr();
+    auto result = Q.solve(yvals);
+    return result;
+}
+
+namespace
+{
+
+// The reference line of up to this many waypoints is fitted on the stack,
+// the simulator sends six.
+const int max_fit_points = 32;
+typedef Eigen::Matrix<double, Eigen::Dynamic, 4, Eigen::ColMajor, max_fit_points, 4> FitMatrix;
+typedef Eigen::Matrix<double, Eigen::Dynamic, 1, Eigen::ColMajor, max_fit_points, 1> FitVector;
+
+}
+
+void to_car_frame(const Telemetry &telemetry, CarFrame &frame)
+{
+    const auto &ptsx = telemetry.ptsx;
+    const auto &ptsy = telemetry.ptsy;
+    const double px = telemetry.x;
+    const double py = telemetry.y;
+    const double psi = telemetry.psi;
+    const double v = telemetry.speed * 1609.34 / 3600.; // in m/s
+
+    frame.x_vals.resize(ptsx.size());
+    frame.y_vals.resize(ptsy.size());
+    for (std::size_t i = 0; i < ptsx.size(); ++i)
+    {
+        double x = ptsx[i] - px, y = ptsy[i] - py;
+        frame.x_vals[i] =  x * std::cos(-psi) - y * std::sin(-psi);
+        frame.y_vals[i] =  x * std::sin(-psi) + y * std::cos(-psi);
+    }
+
+    // The cubic of polyfit, without heap allocations unless there are more
+    // waypoints than the stack matrices hold.
+    const auto n = static_cast<Eigen::Index>(ptsx.size());
+    if (n <= max_fit_points)
+    {
+        FitMatrix A(n, 4);
+        FitVector b(n);
+        for (Eigen::Index i = 0; i < n; ++i)
+        {
+            A(i, 0) = 1.;
+            for (int j = 0; j < 3; ++j)
+                A(i, j + 1) = A(i, j) * frame.x_vals[i];
+            b(i) = frame.y_vals[i];
+        }
+        frame.coeffs = A.householderQr().solve(b);
+    }
+    else
+    {
+        frame.coeffs = polyfit(Eigen::Map<const Eigen::VectorXd>(frame.x_vals.data(), n),
+                               Eigen::Map<const Eigen::VectorXd>(frame.y_vals.data(), n), 3);
+    }
+    auto cte = polyeval(frame.coeffs, 0.);
+    auto epsi = -atanf(frame.coeffs[1]);
+
+    // state in car coordniates
+    frame.state.resize(6);
+    frame.state << 0., 0., 0., v, cte, epsi;
+}
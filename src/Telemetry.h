@@ -0,0 +1,34 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <vector>
+#include "Eigen-3.3/Eigen/Core"
+
+// Telemetry fields sent by the simulator, see DATA.md.
+struct Telemetry
+{
+    std::vector<double> ptsx, ptsy; // waypoints in global coordinates
+    double x, y;                    // vehicle position in global coordinates
+    double psi;                     // orientation in rad
+    double speed;                   // velocity in mph
+};
+
+// Reference line and initial state in the vehicle coordinate system.
+struct CarFrame
+{
+    std::vector<double> x_vals, y_vals; // waypoints
+    Eigen::VectorXd coeffs;             // cubic fitted to the waypoints
+    Eigen::VectorXd state;              // x, y, psi, v, cte, epsi
+};
+
+// Evaluate a polynomial.
+double polyeval(const Eigen::VectorXd &coeffs, double x);
+
+// Fit a polynomial.
+Eigen::VectorXd polyfit(const Eigen::VectorXd &xvals, const Eigen::VectorXd &yvals, int order);
+
+// Transform the waypoints into the vehicle coordinate system, fit the
+// reference line and compute the initial state of the controller.
+void to_car_frame(const Telemetry &telemetry, CarFrame &frame);
+
+#endif /* TELEMETRY_H */
@@ -0,0 +1,104 @@
+#include "ThreadPool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(std::size_t count) : stolen(0)
+{
+    if (count == 0)
+        count = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t k = 0; k < count; ++k)
+        queues.emplace_back(new Queue);
+    for (std::size_t k = 0; k < count; ++k)
+        threads.emplace_back(&ThreadPool::work, this, k);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+    }
+    start.notify_all();
+    for (auto &thread : threads)
+        thread.join();
+}
+
+void ThreadPool::run(std::size_t count, const std::function<void(std::size_t, std::size_t)> &f)
+{
+    if (count == 0)
+        return;
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (std::size_t item = 0; item < count; ++item)
+    {
+        auto &queue = *queues[item % queues.size()];
+        std::lock_guard<std::mutex> queue_lock(queue.mutex);
+        queue.items.push_back(item);
+    }
+    task = &f;
+    remaining = count;
+    ++generation;
+    start.notify_all();
+
+    // No worker may still look for items when the next run fills the queues.
+    done.wait(lock, [this] { return remaining == 0 && active == 0; });
+    task = nullptr;
+}
+
+bool ThreadPool::take(std::size_t worker, std::size_t &item)
+{
+    {
+        auto &queue = *queues[worker];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.items.empty())
+        {
+            item = queue.items.back();
+            queue.items.pop_back();
+            return true;
+        }
+    }
+
+    for (std::size_t k = 1; k < queues.size(); ++k)
+    {
+        auto &queue = *queues[(worker + k) % queues.size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (!queue.items.empty())
+        {
+            item = queue.items.front();
+            queue.items.pop_front();
+            ++stolen;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::work(std::size_t worker)
+{
+    std::size_t seen = 0;
+    while (true)
+    {
+        const std::function<void(std::size_t, std::size_t)> *f;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            start.wait(lock, [this, seen] { return stop || (task && generation != seen); });
+            if (stop)
+                return;
+            seen = generation;
+            f = task;
+            ++active;
+        }
+
+        std::size_t item, finished = 0;
+        while (take(worker, item))
+        {
+            (*f)(item, worker);
+            ++finished;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        remaining -= finished;
+        --active;
+        if (remaining == 0 && active == 0)
+            done.notify_all();
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent worker threads with work stealing.
+//
+// run() deals the items round robin to a queue per worker.  A worker takes
+// items from the back of its own queue and, once it is empty, steals from
+// the front of the others, so items of uneven cost are balanced without a
+// shared queue.
+class ThreadPool
+{
+public:
+    // Start threads workers, 0 for one per hardware thread.
+    explicit ThreadPool(std::size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    std::size_t size() const { return threads.size(); }
+
+    // Call task(item, worker) for every item in [0, count) on the workers
+    // and wait until all are done.  worker is in [0, size()).
+    void run(std::size_t count, const std::function<void(std::size_t, std::size_t)> &task);
+
+    // Items taken from the queue of another worker.
+    std::size_t steals() const { return stolen; }
+
+private:
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<std::size_t> items;
+    };
+
+    void work(std::size_t worker);
+    bool take(std::size_t worker, std::size_t &item);
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+
+    std::mutex mutex;
+    std::condition_variable start, done;
+    const std::function<void(std::size_t, std::size_t)> *task = nullptr;
+    std::size_t generation = 0; // of the current run
+    std::size_t remaining = 0;  // items of the run not yet finished
+    std::size_t active = 0;     // workers taking items
+    bool stop = false;
+    std::atomic<std::size_t> stolen;
+};
+
+#endif /* THREADPOOL_H */
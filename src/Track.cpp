@@ -0,0 +1,99 @@
+#include "Track.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <limits>
+
+bool Track::load(const std::string &path)
+{
+    std::ifstream input(path);
+    if (!input)
+        return false;
+
+    x.clear();
+    y.clear();
+    std::string line;
+    std::getline(input, line); // header
+    while (std::getline(input, line))
+    {
+        double px, py;
+        if (std::sscanf(line.c_str(), "%lf,%lf", &px, &py) == 2)
+        {
+            x.push_back(px);
+            y.push_back(py);
+        }
+    }
+    if (x.size() < 2)
+        return false;
+
+    s.assign(1, 0.);
+    for (std::size_t i = 0; i < x.size(); ++i)
+    {
+        auto j = (i + 1) % x.size();
+        s.push_back(s.back() + std::hypot(x[j] - x[i], y[j] - y[i]));
+    }
+    return true;
+}
+
+void Track::pose(double at, double &px, double &py, double &heading) const
+{
+    at = std::fmod(at, length());
+    if (at < 0.)
+        at += length();
+
+    std::size_t i = 0;
+    while (i + 1 < x.size() && s[i + 1] <= at)
+        ++i;
+
+    auto j = (i + 1) % x.size();
+    auto t = (at - s[i]) / (s[i + 1] - s[i]);
+    px = x[i] + t * (x[j] - x[i]);
+    py = y[i] + t * (y[j] - y[i]);
+    heading = std::atan2(y[j] - y[i], x[j] - x[i]);
+}
+
+std::size_t Track::segment(double px, double py) const
+{
+    std::size_t best = 0;
+    double best_distance = std::numeric_limits<double>::max();
+    for (std::size_t i = 0; i < x.size(); ++i)
+    {
+        auto j = (i + 1) % x.size();
+        double dx = x[j] - x[i], dy = y[j] - y[i];
+        double t = ((px - x[i]) * dx + (py - y[i]) * dy) / (dx * dx + dy * dy);
+        t = std::max(0., std::min(1., t));
+        double distance = std::hypot(x[i] + t * dx - px, y[i] + t * dy - py);
+        if (distance < best_distance)
+        {
+            best_distance = distance;
+            best = i;
+        }
+    }
+    return best;
+}
+
+double Track::project(double px, double py, double &cte) const
+{
+    auto i = segment(px, py);
+    auto j = (i + 1) % x.size();
+    double dx = x[j] - x[i], dy = y[j] - y[i];
+    double len = std::hypot(dx, dy);
+    double t = ((px - x[i]) * dx + (py - y[i]) * dy) / (len * len);
+    t = std::max(0., std::min(1., t));
+    cte = (dx * (py - y[i]) - dy * (px - x[i])) / len;
+    return s[i] + t * len;
+}
+
+void Track::waypoints(double px, double py, std::size_t count,
+                      std::vector<double> &ptsx, std::vector<double> &ptsy) const
+{
+    auto i = segment(px, py);
+    ptsx.resize(count);
+    ptsy.resize(count);
+    for (std::size_t k = 0; k < count; ++k)
+    {
+        ptsx[k] = x[(i + k) % x.size()];
+        ptsy[k] = y[(i + k) % x.size()];
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef TRACK_H
+#define TRACK_H
+
+#include <string>
+#include <vector>
+
+// Closed track given by the waypoints of its center line,
+// e.g. lake_track_waypoints.csv.
+class Track
+{
+public:
+    // Read `x,y` lines with a header line.
+    bool load(const std::string &path);
+
+    std::size_t size() const { return x.size(); }
+    double length() const { return s.empty() ? 0. : s.back(); }
+
+    // Position and heading of the center line at the arc length `at`.
+    void pose(double at, double &px, double &py, double &heading) const;
+
+    // Arc length of the point of the center line closest to (px, py) and
+    // the signed distance to it, positive on the left side.
+    double project(double px, double py, double &cte) const;
+
+    // The `count` waypoints starting at the segment closest to (px, py),
+    // as the simulator sends them.
+    void waypoints(double px, double py, std::size_t count,
+                   std::vector<double> &ptsx, std::vector<double> &ptsy) const;
+
+private:
+    std::size_t segment(double px, double py) const;
+
+    std::vector<double> x, y;
+    std::vector<double> s; // arc length at each waypoint, s[size()] closes the loop
+};
+
+#endif /* TRACK_H */
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Config.h"
+#include "MPC.h"
+#include "RunLog.h"
+#include "Telemetry.h"
+#include "ThreadPool.h"
+#include "Track.h"
+
+// Offline re-solve of recorded runs.
+//
+//   mpc_batch --data doc/data/fifth.data [--threads 1] [--output resolved.mpcl]
+//             [--print 1] [--ipopt.linear_solver ma27] [controller options]
+//
+// Every cycle of a run log or text log is solved again from its recorded
+// pose with the waypoints of the track, independently of the others, with
+// MPC::SolveBatch on --threads workers, 1 by default and 0 for all
+// hardware threads.  The steering angle of the previous recorded cycle is
+// the last actuation.  The tool reports the differences of the actuations
+// and costs to the recorded run, --output writes the re-solved cycles as a
+// run log to diff with mpc_log and --print writes `cycle steer throttle
+// cost` of the recording and the re-solve as text lines.  More than one
+// worker needs a thread safe linear solver in Ipopt, see
+// thread_safe_linear_solver.
+
+int main(int argc, char **argv)
+{
+    Config config;
+    config.parse(argc, argv);
+
+    Track track;
+    if (!track.load(config.get("track", "lake_track_waypoints.csv")))
+    {
+        std::cerr << "Failed to load the track" << std::endl;
+        return -1;
+    }
+
+    std::vector<std::vector<double>> recorded;
+    if (!read_run(config.get("data", "doc/data/fifth.data"), recorded) || recorded[run_px].empty())
+    {
+        std::cerr << "No cycles" << std::endl;
+        return -1;
+    }
+    const std::size_t count = recorded[run_px].size();
+
+    ThreadPool pool(std::max(0, config.get("threads", 1)));
+    if (pool.size() > 1 && !thread_safe_linear_solver(config))
+    {
+        std::cerr << "Parallel solves need a thread safe --ipopt.linear_solver, e.g. ma27" << std::endl;
+        return -1;
+    }
+    if (pool.size() > 1)
+        setup_parallel_solves(pool.size());
+    if (!check_options(config))
+        return -1;
+
+    std::vector<Problem> problems(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        Telemetry telemetry;
+        telemetry.x = recorded[run_px][i];
+        telemetry.y = recorded[run_py][i];
+        telemetry.psi = recorded[run_psi][i];
+        telemetry.speed = recorded[run_v][i] * 3600. / 1609.34; // in mph
+        track.waypoints(telemetry.x, telemetry.y, 6, telemetry.ptsx, telemetry.ptsy);
+
+        CarFrame frame;
+        to_car_frame(telemetry, frame);
+        auto &problem = problems[i];
+        problem.state = frame.state;
+        problem.coeffs = frame.coeffs;
+        problem.minx = frame.x_vals.front();
+        problem.maxx = frame.x_vals.back();
+        problem.last_delta = i ? recorded[run_steer][i - 1] : 0.;
+    }
+
+    MPC mpc(config);
+    std::vector<Plan> plans;
+    auto start = std::chrono::steady_clock::now();
+    mpc.SolveBatch(problems, plans, pool);
+    double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<std::vector<double>> solved(run_columns, std::vector<double>(count));
+    std::vector<char> failed(count);
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        const auto &plan = plans[i];
+        failed[i] = !plan.ok();
+        for (int k : {run_px, run_py, run_psi, run_v})
+            solved[k][i] = recorded[k][i];
+        solved[run_cost][i] = plan.cost;
+        solved[run_steer][i] = plan.delta;
+        solved[run_throttle][i] = plan.a;
+        solved[run_ref_v][i] = plan.ref_v;
+    }
+
+    if (config.has("output"))
+    {
+        RunLogWriter log;
+        if (!log.open(config.get("output", "")))
+        {
+            std::cerr << "Failed to open the output" << std::endl;
+            return -1;
+        }
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            double row[run_columns];
+            for (int k = 0; k < run_columns; ++k)
+                row[k] = solved[k][i];
+            log.add(row);
+        }
+        if (!log.close())
+        {
+            std::cerr << "Failed to write the output" << std::endl;
+            return -1;
+        }
+    }
+
+    if (config.get("print", 0))
+    {
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            std::cout << i << " " << recorded[run_steer][i] << " " << solved[run_steer][i] << " "
+                      << recorded[run_throttle][i] << " " << solved[run_throttle][i] << " "
+                      << recorded[run_cost][i] << " " << solved[run_cost][i] << "\n";
+        }
+        return 0;
+    }
+
+    double sum_steer = 0., max_steer = 0., sum_throttle = 0., max_throttle = 0.;
+    std::size_t failures = 0;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        if (failed[i])
+        {
+            ++failures;
+            continue;
+        }
+        double steer = std::fabs(solved[run_steer][i] - recorded[run_steer][i]);
+        double throttle = std::fabs(solved[run_throttle][i] - recorded[run_throttle][i]);
+        sum_steer += steer;
+        max_steer = std::max(max_steer, steer);
+        sum_throttle += throttle;
+        max_throttle = std::max(max_throttle, throttle);
+    }
+    const std::size_t solved_count = std::max<std::size_t>(1, count - failures);
+
+    std::cout << "cycles        " << count << "\n"
+              << "threads       " << pool.size() << "\n"
+              << "steals        " << pool.steals() << "\n"
+              << "failures      " << failures << "\n"
+              << "time s        " << time << "\n"
+              << "cycles/s      " << count / time << "\n"
+              << "cycles/s/core " << count / time / pool.size() << "\n"
+              << "steer diff    mean " << sum_steer / solved_count << " max " << max_steer << " rad\n"
+              << "throttle diff mean " << sum_throttle / solved_count << " max " << max_throttle << std::endl;
+    return 0;
+}
@@ -0,0 +1,602 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <new>
+#include <numeric>
+#include <string>
+#include <vector>
+#include "Config.h"
+#include "Frames.h"
+#include "MPC.h"
+#include "Model.h"
+#include "Protocol.h"
+#include "StageNLP.h"
+#include "Telemetry.h"
+#include "Track.h"
+
+// Benchmark harness for the controller.
+//
+// Replays synthetic telemetry generated along the lake track: the vehicle is
+// placed on the center line with a varying lateral offset, heading error and
+// speed and receives the next six waypoints as from the simulator.
+//
+//   mpc_bench [--track lake_track_waypoints.csv] [--frames 500] [--speed 50]
+//             [--blocks "1;2;1x4,2x4,4"] [--dt "0.05x39;0.05x4,0.1x6,0.2x5"]
+//             [--integrator "euler;rk2;rk4;arc"] [--model "kinematic;dynamic"]
+//             [--backend "cppad;autodiff"] [--backend.threads "1;2;4"] [--backend.vectorize "0;1"]
+//   mpc_bench --mode parse [--frames 500] [--rounds 20]
+//   mpc_bench --mode protocol [--frames 500] [--rounds 20]
+//
+// --data doc/data/first.data replaces the synthetic frames by the poses of a
+// recorded run.
+//
+// Controller options take a semicolon separated list of values and every
+// combination of them solves the same frames.  Solve times, costs and
+// actuations are reported against the first combination.  The prediction
+// error is the distance between the end of the predicted trajectory and a
+// fine integration of the planned actuations and the planned speed is the
+// speed at the end of the horizon, which shows how fast the controller
+// dares to drive with the model.  --speed is the mean frame speed in mph.
+// The iterations are those of Ipopt if the backend reports them.  The
+// speedup of the stage parallel evaluation over the horizon length shows
+// with e.g. `--backend autodiff --backend.threads "1;4" --dt "0.05x39;0.02x99;0.01x199"`.
+// The allocations are counted by replacing the global operator new and
+// include those of CppAD and Ipopt inside Solve, which allocate on every
+// solve and are only reported.  The parts of a cycle that the controller
+// owns have to be free of allocations once the buffers are warm and fail
+// the bench if they allocate after the first two frames: "frame allocs"
+// are those of the conversion of a frame and the binary reply around
+// Solve, "eval allocs" those of the autodiff backend evaluating the
+// objective, the constraints and their derivatives at the plan of every
+// frame on the calling thread, as Ipopt does for every iterate.
+//
+// The parse mode formats the frames as simulator messages and compares the
+// message handling of nlohmann::json on the heap, arena_json on an arena
+// that is reset after every frame and the event parser of the handler,
+// which fails the bench if it allocates.
+//
+// The protocol mode checks that the binary messages reproduce telemetry and
+// steer replies exactly and reject truncated input, then compares round
+// trips of the JSON text and the binary messages.  The binary round trips
+// fail the bench if they allocate.
+
+// Number of heap allocations, to check what a steady state Solve allocates.
+static std::atomic<std::size_t> allocations(0);
+
+void *operator new(std::size_t size)
+{
+    ++allocations;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0.;
+    std::sort(values.begin(), values.end());
+    return values[static_cast<std::size_t>(p * (values.size() - 1))];
+}
+
+struct Result
+{
+    std::vector<double> time, cost, steer, throttle, error, speed, allocs, frame_allocs, eval_allocs, iterations;
+};
+
+// The callbacks of the autodiff backend that Ipopt calls for every iterate.
+class Evaluator
+{
+public:
+    virtual ~Evaluator() {}
+
+    // Evaluate at the plan of the frame and return the allocations.
+    virtual std::size_t evaluate(const Plan &plan, const CarFrame &frame) = 0;
+};
+
+template <typename Model>
+class StageEvaluator : public Evaluator
+{
+public:
+    StageEvaluator(const MPC &mpc, const Model &model, bool vectorize)
+        : layout(mpc.layout), nlp(mpc.layout, model, mpc.integrator, mpc.cost), x(layout.n_vars),
+          gradient(layout.n_vars), constraints(layout.n_constraints)
+    {
+        nlp.vectorize = vectorize;
+        Ipopt::Index n, m, nnz_jac_g, nnz_h_lag;
+        Ipopt::TNLP::IndexStyleEnum style;
+        nlp.get_nlp_info(n, m, nnz_jac_g, nnz_h_lag, style);
+        jacobian.resize(nnz_jac_g);
+    }
+
+    std::size_t evaluate(const Plan &plan, const CarFrame &frame) override
+    {
+        if (plan.N != layout.N)
+            return 0;
+        const auto N = layout.N;
+        for (std::size_t k = 0; k < layout.n_states; ++k)
+            std::copy(plan.states[k].begin(), plan.states[k].begin() + N, x.begin() + layout.x_start + k * N);
+        for (std::size_t i = 0; i + 1 < N; ++i)
+        {
+            x[layout.delta_start + layout.block[i]] = plan.inputs[0][i];
+            x[layout.a_start + layout.block[i]] = plan.inputs[1][i];
+        }
+        nlp.coeffs = frame.coeffs;
+        nlp.ref_v = plan.ref_v;
+
+        const std::size_t before = allocations;
+        const Ipopt::Index n = layout.n_vars, m = layout.n_constraints;
+        double objective;
+        nlp.eval_f(n, x.data(), true, objective);
+        nlp.eval_grad_f(n, x.data(), false, gradient.data());
+        nlp.eval_g(n, x.data(), false, m, constraints.data());
+        nlp.eval_jac_g(n, x.data(), false, m, jacobian.size(), nullptr, nullptr, jacobian.data());
+        return allocations - before;
+    }
+
+private:
+    const Layout &layout;
+    StageNLP<Model> nlp;
+    std::vector<double> x, gradient, constraints, jacobian;
+};
+
+std::unique_ptr<Evaluator> make_evaluator(const MPC &mpc, bool vectorize)
+{
+    if (mpc.backend != Backend::autodiff)
+        return nullptr;
+    if (mpc.model_type == ModelType::dynamic)
+        return std::unique_ptr<Evaluator>(new StageEvaluator<DynamicModel>(mpc, mpc.dynamic_model, vectorize));
+    return std::unique_ptr<Evaluator>(new StageEvaluator<KinematicModel>(mpc, mpc.kinematic_model, vectorize));
+}
+
+// Integrate the planned actuations with RK4 at 1 ms steps and return the
+// distance to the predicted position at the end of the horizon.
+template <typename Model>
+double prediction_error(const Plan &plan, const Model &model)
+{
+    const int n = Model::n_states;
+    const auto N = plan.N;
+
+    double s[n], u[Model::n_inputs], k1[n], k2[n], k3[n], k4[n], tmp[n];
+    for (int k = 0; k < n; ++k)
+        s[k] = plan.states[k][0];
+
+    for (std::size_t i = 0; i + 1 < N; ++i)
+    {
+        u[Model::delta] = plan.inputs[0][i];
+        u[Model::a] = plan.inputs[1][i];
+        double duration = plan.t[i + 1] - plan.t[i];
+        int steps = static_cast<int>(std::ceil(duration / 1e-3));
+        double h = duration / steps;
+        for (int j = 0; j < steps; ++j)
+        {
+            model.derivatives(s, u, k1);
+            for (int k = 0; k < n; ++k)
+                tmp[k] = s[k] + k1[k] * h / 2.;
+            model.derivatives(tmp, u, k2);
+            for (int k = 0; k < n; ++k)
+                tmp[k] = s[k] + k2[k] * h / 2.;
+            model.derivatives(tmp, u, k3);
+            for (int k = 0; k < n; ++k)
+                tmp[k] = s[k] + k3[k] * h;
+            model.derivatives(tmp, u, k4);
+            for (int k = 0; k < n; ++k)
+                s[k] += (k1[k] + 2. * k2[k] + 2. * k3[k] + k4[k]) * h / 6.;
+        }
+    }
+
+    return std::hypot(s[Model::x] - plan.x()[N - 1], s[Model::y] - plan.y()[N - 1]);
+}
+
+Result run(MPC &mpc, const std::vector<Telemetry> &frames, Evaluator *evaluator)
+{
+    Result result;
+    CarFrame frame;
+    Plan plan;
+    Steer steer;
+    std::string message;
+    for (const auto &telemetry : frames)
+    {
+        std::size_t before = allocations;
+        to_car_frame(telemetry, frame);
+        const std::size_t converted = allocations - before;
+
+        before = allocations;
+        bool ok = mpc.Solve(frame.state, frame.coeffs, frame.x_vals.front(), frame.x_vals.back(), plan);
+        result.allocs.push_back(allocations - before);
+
+        // The binary reply as the server builds it.
+        before = allocations;
+        steer.steering_angle = -plan.delta / deg2rad(25);
+        steer.throttle = plan.a;
+        steer.mpc_x.assign(plan.x(), plan.x() + plan.N);
+        steer.mpc_y.assign(plan.y(), plan.y() + plan.N);
+        steer.next_x.swap(frame.x_vals);
+        steer.next_y.swap(frame.y_vals);
+        encode_steer(steer, message);
+        result.frame_allocs.push_back(converted + allocations - before);
+        if (evaluator)
+            result.eval_allocs.push_back(evaluator->evaluate(plan, frame));
+
+        result.time.push_back(plan.solve_time);
+        result.cost.push_back(plan.cost);
+        result.steer.push_back(plan.delta);
+        result.throttle.push_back(plan.a);
+        result.iterations.push_back(plan.iterations < 0 ? std::numeric_limits<double>::quiet_NaN() : plan.iterations);
+        if (!ok)
+        {
+            result.error.push_back(std::numeric_limits<double>::quiet_NaN());
+            result.speed.push_back(std::numeric_limits<double>::quiet_NaN());
+            continue;
+        }
+        result.error.push_back(mpc.model_type == ModelType::dynamic ? prediction_error(plan, mpc.dynamic_model)
+                               : prediction_error(plan, mpc.kinematic_model));
+        result.speed.push_back(plan.states[KinematicModel::v][plan.N - 1]);
+    }
+    return result;
+}
+
+double mean(const std::vector<double> &values)
+{
+    double sum = 0.;
+    std::size_t count = 0;
+    for (auto value : values)
+    {
+        if (std::isfinite(value))
+        {
+            sum += value;
+            ++count;
+        }
+    }
+    return count ? sum / count : 0.;
+}
+
+// Controller options that can be varied between runs.
+const std::vector<std::string> axes = {"blocks", "dt", "integrator", "model", "backend", "backend.threads",
+                                       "backend.vectorize"};
+
+double mean_difference(const std::vector<double> &a, const std::vector<double> &b)
+{
+    std::vector<double> difference(a.size());
+    for (std::size_t i = 0; i < a.size(); ++i)
+        difference[i] = std::fabs(a[i] - b[i]);
+    return mean(difference);
+}
+
+// Parse the messages after a warm up round and print the times, the
+// throughput and the allocations per message.
+template <typename Parse>
+double parse_frames(Parse parse, const std::vector<std::string> &messages, int rounds)
+{
+    Telemetry telemetry;
+    std::string buffer;
+    std::size_t bytes = 0;
+    for (const auto &message : messages)
+    {
+        parse(message, telemetry, buffer);
+        bytes += message.size();
+    }
+
+    std::vector<double> time;
+    time.reserve(rounds * messages.size());
+    std::size_t before = allocations;
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (const auto &message : messages)
+        {
+            auto start = std::chrono::steady_clock::now();
+            parse(message, telemetry, buffer);
+            time.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+    double allocs = static_cast<double>(allocations - before) / time.size();
+
+    std::cout << std::fixed << std::setprecision(2)
+              << std::setw(12) << mean(time) * 1e6 << std::setw(12) << percentile(time, 0.95) * 1e6
+              << std::setw(12) << bytes / (mean(time) * messages.size()) / 1e6
+              << std::setw(12) << allocs << std::defaultfloat << std::endl;
+    return allocs;
+}
+
+int run_parse(const std::vector<Telemetry> &frames, int rounds)
+{
+    std::vector<std::string> messages(frames.size());
+    for (std::size_t i = 0; i < frames.size(); ++i)
+        format_telemetry(frames[i], messages[i]);
+
+    // The event parser has to agree with the documents.
+    std::size_t mismatches = 0;
+    Telemetry expected, actual;
+    std::string buffer;
+    for (const auto &message : messages)
+    {
+        const char *begin, *end;
+        event_data(message.data(), message.size(), begin, end);
+        parse_telemetry<nlohmann::json>(begin, end, expected, buffer);
+        read_telemetry(begin, end, actual, buffer);
+        if (actual.ptsx != expected.ptsx || actual.ptsy != expected.ptsy || actual.x != expected.x ||
+            actual.y != expected.y || actual.psi != expected.psi || actual.speed != expected.speed)
+            ++mismatches;
+    }
+    if (mismatches)
+        std::cerr << mismatches << " messages differ between the parsers" << std::endl;
+
+    std::cout << std::setw(40) << std::left << "parser" << std::right << std::setw(12) << "mean us"
+              << std::setw(12) << "p95 us" << std::setw(12) << "MB/s" << std::setw(12) << "allocs" << std::endl;
+
+    std::cout << std::setw(40) << std::left << "json" << std::right;
+    parse_frames([](const std::string &message, Telemetry &telemetry, std::string &buffer) {
+                     const char *begin, *end;
+                     if (event_data(message.data(), message.size(), begin, end))
+                         parse_telemetry<nlohmann::json>(begin, end, telemetry, buffer);
+                 }, messages, rounds);
+
+    // As the message handler did before the event parser, the arena is
+    // reset after every frame.
+    Arena arena;
+    std::cout << std::setw(40) << std::left << "arena_json" << std::right;
+    parse_frames([&arena](const std::string &message, Telemetry &telemetry, std::string &buffer) {
+                     Arena::Frame frame(arena);
+                     const char *begin, *end;
+                     if (event_data(message.data(), message.size(), begin, end))
+                         parse_telemetry<arena_json>(begin, end, telemetry, buffer);
+                 }, messages, rounds);
+
+    std::cout << std::setw(40) << std::left << "sax" << std::right;
+    const double allocs = parse_frames([](const std::string &message, Telemetry &telemetry, std::string &buffer) {
+                                           const char *begin, *end;
+                                           if (event_data(message.data(), message.size(), begin, end))
+                                               read_telemetry(begin, end, telemetry, buffer);
+                                       }, messages, rounds);
+    if (allocs > 0.)
+        std::cerr << "The event parser allocates " << allocs << " times per message" << std::endl;
+    return mismatches || allocs > 0. ? -1 : 0;
+}
+
+// Replies with the reference line of the frames and a prediction along it.
+std::vector<Steer> make_steers(const std::vector<Telemetry> &frames)
+{
+    std::vector<Steer> steers(frames.size());
+    CarFrame frame;
+    for (std::size_t i = 0; i < frames.size(); ++i)
+    {
+        to_car_frame(frames[i], frame);
+        auto &steer = steers[i];
+        steer.steering_angle = std::sin(0.1 * i);
+        steer.throttle = std::cos(0.1 * i);
+        for (int k = 0; k < 40; ++k)
+        {
+            double x = frame.x_vals.back() * k / 40.;
+            steer.mpc_x.push_back(x);
+            steer.mpc_y.push_back(polyeval(frame.coeffs, x));
+        }
+        steer.next_x = frame.x_vals;
+        steer.next_y = frame.y_vals;
+    }
+    return steers;
+}
+
+bool same(const Telemetry &a, const Telemetry &b)
+{
+    return a.ptsx == b.ptsx && a.ptsy == b.ptsy && a.x == b.x && a.y == b.y && a.psi == b.psi && a.speed == b.speed;
+}
+
+bool same(const Steer &a, const Steer &b)
+{
+    return a.steering_angle == b.steering_angle && a.throttle == b.throttle && a.mpc_x == b.mpc_x &&
+           a.mpc_y == b.mpc_y && a.next_x == b.next_x && a.next_y == b.next_y;
+}
+
+// Encode and decode every message with the binary protocol, which has to
+// reproduce it exactly, and check that all truncations are rejected.
+template <typename Message, typename Encode, typename Decode>
+std::size_t check_round_trip(const std::vector<Message> &messages, Encode encode, Decode decode)
+{
+    std::size_t failures = 0;
+    std::string buffer;
+    Message decoded;
+    for (const auto &message : messages)
+    {
+        encode(message, buffer);
+        if (!decode(buffer.data(), buffer.size(), decoded) || !same(message, decoded))
+            ++failures;
+        for (std::size_t length = 0; length < buffer.size(); ++length)
+        {
+            if (decode(buffer.data(), length, decoded))
+                ++failures;
+        }
+    }
+    return failures;
+}
+
+// Time a round trip of every message and print the times per message, the
+// message size and the throughput.
+template <typename Message, typename RoundTrip>
+std::size_t time_round_trip(const char *label, const std::vector<Message> &messages, RoundTrip round_trip, int rounds)
+{
+    std::string buffer;
+    Message decoded;
+    std::size_t bytes = 0;
+    for (const auto &message : messages)
+        bytes += round_trip(message, buffer, decoded);
+
+    std::vector<double> time;
+    time.reserve(rounds * messages.size());
+    const std::size_t before = allocations;
+    for (int round = 0; round < rounds; ++round)
+    {
+        for (const auto &message : messages)
+        {
+            auto start = std::chrono::steady_clock::now();
+            round_trip(message, buffer, decoded);
+            time.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+        }
+    }
+    const std::size_t allocs = allocations - before;
+
+    std::cout << std::setw(40) << std::left << label << std::right << std::fixed << std::setprecision(2)
+              << std::setw(12) << mean(time) * 1e6 << std::setw(12) << percentile(time, 0.95) * 1e6
+              << std::setw(12) << static_cast<double>(bytes) / messages.size()
+              << std::setw(12) << bytes / (mean(time) * messages.size()) / 1e6 << std::defaultfloat << std::endl;
+    return allocs;
+}
+
+int run_protocol(const std::vector<Telemetry> &frames, int rounds)
+{
+    auto steers = make_steers(frames);
+
+    std::size_t failures = check_round_trip(frames, encode_telemetry, decode_telemetry) +
+                           check_round_trip(steers, encode_steer, decode_steer);
+    std::string hello;
+    std::uint16_t version = 0;
+    encode_hello(hello);
+    if (message_type(hello.data(), hello.size(), version) != MessageType::hello || version != protocol_version)
+        ++failures;
+    if (failures)
+        std::cerr << failures << " binary round trips failed" << std::endl;
+
+    std::cout << std::setw(40) << std::left << "round trip" << std::right << std::setw(12) << "mean us"
+              << std::setw(12) << "p95 us" << std::setw(12) << "bytes" << std::setw(12) << "MB/s" << std::endl;
+
+    std::string text;
+    time_round_trip("telemetry json", frames, [&text](const Telemetry &telemetry, std::string &buffer, Telemetry &decoded) {
+                        format_telemetry(telemetry, text);
+                        const char *begin, *end;
+                        event_data(text.data(), text.size(), begin, end);
+                        read_telemetry(begin, end, decoded, buffer);
+                        return text.size();
+                    }, rounds);
+    std::size_t allocs = time_round_trip("telemetry binary", frames, [](const Telemetry &telemetry, std::string &buffer, Telemetry &decoded) {
+                        encode_telemetry(telemetry, buffer);
+                        decode_telemetry(buffer.data(), buffer.size(), decoded);
+                        return buffer.size();
+                    }, rounds);
+
+    // The simulator parses the steer event into a document.
+    Arena arena;
+    time_round_trip("steer json", steers, [&arena](const Steer &steer, std::string &buffer, Steer &decoded) {
+                        Arena::Frame frame(arena);
+                        format_steer(steer, buffer);
+                        const char *begin, *end;
+                        event_data(buffer.data(), buffer.size(), begin, end);
+                        auto j = arena_json::parse(begin, end);
+                        decoded.steering_angle = j[1]["steering_angle"];
+                        return buffer.size();
+                    }, rounds);
+    allocs += time_round_trip("steer binary", steers, [](const Steer &steer, std::string &buffer, Steer &decoded) {
+                        encode_steer(steer, buffer);
+                        decode_steer(buffer.data(), buffer.size(), decoded);
+                        return buffer.size();
+                    }, rounds);
+    if (allocs)
+        std::cerr << "The binary round trips allocate " << allocs << " times" << std::endl;
+    return failures || allocs ? -1 : 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Config config;
+    config.parse(argc, argv);
+
+    Track track;
+    if (!track.load(config.get("track", "lake_track_waypoints.csv")))
+    {
+        std::cerr << "Failed to load the track" << std::endl;
+        return -1;
+    }
+
+    auto frames = config.has("data") ? load_frames(track, config.get("data", ""))
+                  : make_frames(track, config.get("frames", 500), config.get("speed", 50.));
+    if (frames.empty())
+    {
+        std::cerr << "No frames" << std::endl;
+        return -1;
+    }
+    if (config.get("mode", "solve") == "parse")
+        return run_parse(frames, config.get("rounds", 20));
+    if (config.get("mode", "solve") == "protocol")
+        return run_protocol(frames, config.get("rounds", 20));
+
+    if (!config.has("blocks"))
+        config.set("blocks", "1;2;1x4,2x4,4");
+
+    std::vector<std::string> labels;
+    auto configs = make_configs(config, axes, labels);
+    for (const auto &options : configs)
+    {
+        if (!check_options(options))
+            return -1;
+    }
+
+    std::cout << std::setw(40) << std::left << "options" << std::right
+              << std::setw(8) << "stages" << std::setw(8) << "vars"
+              << std::setw(12) << "mean ms" << std::setw(12) << "p50 ms" << std::setw(12) << "p95 ms"
+              << std::setw(12) << "cost" << std::setw(12) << "|dsteer|" << std::setw(12) << "|dthrottle|"
+              << std::setw(12) << "pred err m" << std::setw(12) << "plan v m/s" << std::setw(12) << "allocs"
+              << std::setw(8) << "iter" << std::setw(14) << "frame allocs" << std::setw(14) << "eval allocs"
+              << std::endl;
+
+    Result baseline;
+    std::size_t frame_allocs = 0, eval_allocs = 0;
+    for (std::size_t i = 0; i < configs.size(); ++i)
+    {
+        MPC mpc(configs[i]);
+        auto evaluator = make_evaluator(mpc, configs[i].get("backend.vectorize", 1) != 0);
+        auto result = run(mpc, frames, evaluator.get());
+        if (baseline.time.empty())
+            baseline = result;
+
+        std::cout << std::setw(40) << std::left << labels[i] << std::right
+                  << std::setw(8) << mpc.layout.N << std::setw(8) << mpc.layout.n_vars << std::fixed << std::setprecision(3)
+                  << std::setw(12) << mean(result.time) * 1e3
+                  << std::setw(12) << percentile(result.time, 0.5) * 1e3
+                  << std::setw(12) << percentile(result.time, 0.95) * 1e3
+                  << std::setw(12) << std::setprecision(1) << mean(result.cost) << std::setprecision(4)
+                  << std::setw(12) << mean_difference(result.steer, baseline.steer)
+                  << std::setw(12) << mean_difference(result.throttle, baseline.throttle)
+                  << std::setw(12) << mean(result.error) << std::setw(12) << std::setprecision(2) << mean(result.speed)
+                  << std::setw(12) << std::setprecision(0) << mean(result.allocs)
+                  << std::setw(8) << std::setprecision(1) << mean(result.iterations)
+                  << std::setw(14) << std::setprecision(0) << std::accumulate(result.frame_allocs.begin(), result.frame_allocs.end(), 0.)
+                  << std::setw(14);
+        if (evaluator)
+            std::cout << std::accumulate(result.eval_allocs.begin(), result.eval_allocs.end(), 0.);
+        else
+            std::cout << "-";
+        std::cout << std::defaultfloat << std::endl;
+
+        // The first two frames fill the buffers of the frame and the reply,
+        // which swap the waypoints, and of the coefficients.
+        for (std::size_t k = 2; k < result.frame_allocs.size(); ++k)
+            frame_allocs += static_cast<std::size_t>(result.frame_allocs[k]);
+        for (std::size_t k = 2; k < result.eval_allocs.size(); ++k)
+            eval_allocs += static_cast<std::size_t>(result.eval_allocs[k]);
+    }
+
+    if (frame_allocs)
+    {
+        std::cerr << "The frames and replies allocate " << frame_allocs << " times after the first two frames" << std::endl;
+        return -1;
+    }
+    if (eval_allocs)
+    {
+        std::cerr << "The autodiff evaluations allocate " << eval_allocs << " times after the first two frames" << std::endl;
+        return -1;
+    }
+}
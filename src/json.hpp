@@ -6488,6 +6488,38 @@ class basic_json
         return parse(std::begin(c), std::end(c), cb);
     }
 
+    /*!
+    @brief deserialize from a character range into events of a handler
+
+    Scans the range with the same lexer as @ref parse, but instead of
+    building a JSON value it calls the member functions of @a handler for
+    every structural element and scalar in document order:
+
+    - `bool start_object()`, `bool end_object()`
+    - `bool start_array()`, `bool end_array()`
+    - `bool key(const string_t& name)`
+    - `bool string(const string_t& value)`
+    - `bool number(number_float_t value)` for all numbers
+    - `bool boolean(bool value)`, `bool null()`
+
+    A handler returning `false` stops the scan.  No value is allocated, only
+    strings and keys are unescaped into a string_t.
+
+    @param[in] first  begin of the range to parse
+    @param[in] last  end of the range to parse
+    @param[in,out] handler  receiver of the events
+
+    @return `true` if the whole range was scanned, `false` if the handler
+    stopped the scan
+
+    @throw std::invalid_argument in case of a parse error
+    */
+    template<typename Handler>
+    static bool sax_parse(const char* first, const char* last, Handler& handler)
+    {
+        return sax_parser<Handler>(first, last, handler).parse();
+    }
+
     /*!
     @brief deserialize from stream
 
@@ -11631,6 +11663,229 @@ basic_json_parser_74:
         lexer m_lexer;
     };
 
+    /*!
+    @brief event based syntax analysis
+
+    This class implements a recursive decent parser that reports the
+    structure to a handler instead of building a value, see @ref sax_parse.
+    */
+    template<typename Handler>
+    class sax_parser
+    {
+      public:
+        /// a parser reading from a character range
+        sax_parser(const char* first, const char* last, Handler& h)
+            : handler(h),
+              m_lexer(reinterpret_cast<const typename lexer::lexer_char_t*>(first),
+                      static_cast<size_t>(last - first))
+        {}
+
+        /// public parser interface
+        bool parse()
+        {
+            // read first token
+            get_token();
+
+            if (not parse_internal())
+            {
+                return false;
+            }
+
+            expect(lexer::token_type::end_of_input);
+            return true;
+        }
+
+      private:
+        /// the actual parser, false if the handler stopped
+        bool parse_internal()
+        {
+            switch (last_token)
+            {
+                case lexer::token_type::begin_object:
+                {
+                    if (not handler.start_object())
+                    {
+                        return false;
+                    }
+
+                    // read next token
+                    get_token();
+
+                    // closing } -> we are done
+                    if (last_token != lexer::token_type::end_object)
+                    {
+                        // no comma is expected here
+                        unexpect(lexer::token_type::value_separator);
+
+                        // otherwise: parse key-value pairs
+                        do
+                        {
+                            // ugly, but could be fixed with loop reorganization
+                            if (last_token == lexer::token_type::value_separator)
+                            {
+                                get_token();
+                            }
+
+                            // store key
+                            expect(lexer::token_type::value_string);
+                            if (not handler.key(m_lexer.get_string()))
+                            {
+                                return false;
+                            }
+
+                            // parse separator (:)
+                            get_token();
+                            expect(lexer::token_type::name_separator);
+
+                            // parse and add value
+                            get_token();
+                            if (not parse_internal())
+                            {
+                                return false;
+                            }
+                        }
+                        while (last_token == lexer::token_type::value_separator);
+
+                        // closing }
+                        expect(lexer::token_type::end_object);
+                    }
+
+                    get_token();
+                    return handler.end_object();
+                }
+
+                case lexer::token_type::begin_array:
+                {
+                    if (not handler.start_array())
+                    {
+                        return false;
+                    }
+
+                    // read next token
+                    get_token();
+
+                    // closing ] -> we are done
+                    if (last_token != lexer::token_type::end_array)
+                    {
+                        // no comma is expected here
+                        unexpect(lexer::token_type::value_separator);
+
+                        // otherwise: parse values
+                        do
+                        {
+                            // ugly, but could be fixed with loop reorganization
+                            if (last_token == lexer::token_type::value_separator)
+                            {
+                                get_token();
+                            }
+
+                            // parse value
+                            if (not parse_internal())
+                            {
+                                return false;
+                            }
+                        }
+                        while (last_token == lexer::token_type::value_separator);
+
+                        // closing ]
+                        expect(lexer::token_type::end_array);
+                    }
+
+                    get_token();
+                    return handler.end_array();
+                }
+
+                case lexer::token_type::literal_null:
+                {
+                    get_token();
+                    return handler.null();
+                }
+
+                case lexer::token_type::value_string:
+                {
+                    const auto s = m_lexer.get_string();
+                    get_token();
+                    return handler.string(s);
+                }
+
+                case lexer::token_type::literal_true:
+                {
+                    get_token();
+                    return handler.boolean(true);
+                }
+
+                case lexer::token_type::literal_false:
+                {
+                    get_token();
+                    return handler.boolean(false);
+                }
+
+                case lexer::token_type::value_unsigned:
+                case lexer::token_type::value_integer:
+                case lexer::token_type::value_float:
+                {
+                    // numbers never allocate, so the conversion of the lexer
+                    // can be reused through a temporary value
+                    basic_json value;
+                    m_lexer.get_number(value, last_token);
+                    get_token();
+                    if (value.is_null())
+                    {
+                        return handler.null();
+                    }
+                    return handler.number(value.template get<number_float_t>());
+                }
+
+                default:
+                {
+                    // the last token was unexpected
+                    unexpect(last_token);
+                    return false;
+                }
+            }
+        }
+
+        /// get next token from lexer
+        typename lexer::token_type get_token()
+        {
+            last_token = m_lexer.scan();
+            return last_token;
+        }
+
+        void expect(typename lexer::token_type t) const
+        {
+            if (t != last_token)
+            {
+                std::string error_msg = "parse error - unexpected ";
+                error_msg += (last_token == lexer::token_type::parse_error ? ("'" +  m_lexer.get_token_string() +
+                              "'") :
+                              lexer::token_type_name(last_token));
+                error_msg += "; expected " + lexer::token_type_name(t);
+                JSON_THROW(std::invalid_argument(error_msg));
+            }
+        }
+
+        void unexpect(typename lexer::token_type t) const
+        {
+            if (t == last_token)
+            {
+                std::string error_msg = "parse error - unexpected ";
+                error_msg += (last_token == lexer::token_type::parse_error ? ("'" +  m_lexer.get_token_string() +
+                              "'") :
+                              lexer::token_type_name(last_token));
+                JSON_THROW(std::invalid_argument(error_msg));
+            }
+        }
+
+      private:
+        /// receiver of the events
+        Handler& handler;
+        /// the type of the last read token
+        typename lexer::token_type last_token = lexer::token_type::uninitialized;
+        /// the lexer
+        lexer m_lexer;
+    };
+
   public:
     /*!
     @brief JSON Pointer
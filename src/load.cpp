@@ -0,0 +1,291 @@
+#include <uWS/uWS.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Config.h"
+#include "Frames.h"
+#include "Protocol.h"
+#include "Telemetry.h"
+#include "Track.h"
+
+// Load generator for the controller server.
+//
+// Opens websocket connections to mpc on localhost and sends telemetry
+// frames on each of them as the simulator does, then measures the time from
+// sending a frame to receiving its reply.
+//
+//   mpc_load [--port 4567] [--connections "1;2;4;8;16"] [--rate 10] [--duration 10]
+//            [--window 1] [--deadline 200] [--binary 1] [--data doc/data/first.data]
+//
+// Every connection count of the list is a step of --duration s.  A
+// connection sends up to --rate frames per second but, like the simulator,
+// at most --window frames are waiting for their replies, the frames it could
+// not send in time are counted as skipped.  Replies later than --deadline ms
+// are counted as late and frames without a reply at the end of the step as
+// dropped.  --binary uses the binary protocol instead of the JSON text.
+// Start the server with `./mpc --sleep_ms 0` to measure the controller
+// without the artificial actuation delay.
+
+namespace
+{
+
+typedef std::chrono::steady_clock Clock;
+
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0.;
+    std::sort(values.begin(), values.end());
+    return values[static_cast<std::size_t>(p * (values.size() - 1))];
+}
+
+struct Client
+{
+    std::size_t index = 0;        // in the step
+    uWS::WebSocket<uWS::CLIENT> ws;
+    bool open = false;
+    bool ready = false;           // the binary protocol was negotiated
+    std::size_t frame = 0;        // next frame to send
+    Clock::time_point next;       // time of the next frame
+    std::deque<Clock::time_point> pending; // send times of the frames without reply
+};
+
+class LoadTest
+{
+public:
+    LoadTest(uWS::Hub &hub, const Config &config, const std::vector<Telemetry> &frames)
+        : hub(hub), port(config.get("port", 4567)), rate(config.get("rate", 10.)),
+          duration(config.get("duration", 10.)), deadline(config.get("deadline", 200.) / 1e3),
+          window(config.get("window", 1)), binary(config.get("binary", 0) != 0)
+    {
+        for (const auto &value : split(config.get("connections", "1;2;4;8;16"), ';'))
+            steps.push_back(std::max(1, std::atoi(value.c_str())));
+
+        messages.resize(frames.size());
+        for (std::size_t i = 0; i < frames.size(); ++i)
+        {
+            if (binary)
+                encode_telemetry(frames[i], messages[i]);
+            else
+                format_telemetry(frames[i], messages[i]);
+        }
+        encode_hello(hello);
+    }
+
+    void start()
+    {
+        std::cout << std::setw(12) << "connections" << std::setw(12) << "sent/s" << std::setw(12) << "replies/s"
+                  << std::setw(12) << "p50 ms" << std::setw(12) << "p95 ms" << std::setw(12) << "p99 ms"
+                  << std::setw(12) << "max ms" << std::setw(10) << "late" << std::setw(10) << "dropped"
+                  << std::setw(10) << "skipped" << std::setw(10) << "errors" << std::endl;
+        start_step();
+    }
+
+    void connected(uWS::WebSocket<uWS::CLIENT> ws)
+    {
+        auto client = static_cast<Client *>(ws.getUserData());
+        client->ws = ws;
+        client->open = true;
+        client->ready = !binary;
+        if (binary)
+            ws.send(hello.data(), hello.size(), uWS::OpCode::BINARY);
+
+        // Spread the frames of the connections over the period.
+        client->next = Clock::now() + std::chrono::microseconds(
+            static_cast<long>(1e6 / rate * client->index / steps[step]));
+    }
+
+    void received(uWS::WebSocket<uWS::CLIENT> ws, const char *data, std::size_t length, uWS::OpCode opCode)
+    {
+        auto client = static_cast<Client *>(ws.getUserData());
+        if (opCode == uWS::OpCode::BINARY)
+        {
+            std::uint16_t version;
+            if (message_type(data, length, version) == MessageType::hello)
+            {
+                client->ready = version == protocol_version;
+                return;
+            }
+        }
+        if (!client->open || client->pending.empty())
+            return;
+
+        double latency = std::chrono::duration<double>(Clock::now() - client->pending.front()).count();
+        client->pending.pop_front();
+        latencies.push_back(latency);
+        if (latency > deadline)
+            ++late;
+    }
+
+    void failed()
+    {
+        ++errors;
+    }
+
+    // Send the due frames, called every millisecond.
+    void tick()
+    {
+        auto now = Clock::now();
+        if (sending && now >= step_end)
+        {
+            // Wait for the replies that are on their way.
+            sending = false;
+            step_end = now + std::chrono::milliseconds(static_cast<long>(std::max(1., 2. * deadline) * 1e3));
+        }
+        else if (!sending && now >= step_end)
+        {
+            finish_step();
+            return;
+        }
+        if (!sending)
+            return;
+
+        const auto period = std::chrono::microseconds(static_cast<long>(1e6 / rate));
+        for (auto client = clients.begin() + first; client != clients.end(); ++client)
+        {
+            if (!client->open || !client->ready)
+                continue;
+            while (client->next <= now)
+            {
+                client->next += period;
+                if (client->pending.size() >= window)
+                {
+                    ++skipped;
+                    continue;
+                }
+                const auto &message = messages[client->frame++ % messages.size()];
+                client->pending.push_back(Clock::now());
+                client->ws.send(message.data(), message.size(), binary ? uWS::OpCode::BINARY : uWS::OpCode::TEXT);
+                ++sent;
+            }
+        }
+    }
+
+private:
+    void start_step()
+    {
+        // Clients of earlier steps stay allocated for their late events.
+        first = clients.size();
+        clients.resize(first + steps[step]);
+        latencies.clear();
+        sent = late = skipped = errors = 0;
+        sending = true;
+        step_end = Clock::now() + std::chrono::milliseconds(static_cast<long>(duration * 1e3));
+        for (auto i = first; i < clients.size(); ++i)
+        {
+            clients[i].index = i - first;
+            hub.connect("ws://127.0.0.1:" + std::to_string(port), &clients[i]);
+        }
+    }
+
+    void finish_step()
+    {
+        std::size_t dropped = 0;
+        for (auto client = clients.begin() + first; client != clients.end(); ++client)
+        {
+            dropped += client->pending.size();
+            client->pending.clear();
+            if (client->open)
+                client->ws.close();
+            client->open = false;
+        }
+
+        std::cout << std::setw(12) << steps[step] << std::fixed << std::setprecision(1)
+                  << std::setw(12) << sent / duration << std::setw(12) << latencies.size() / duration
+                  << std::setprecision(2)
+                  << std::setw(12) << percentile(latencies, 0.5) * 1e3
+                  << std::setw(12) << percentile(latencies, 0.95) * 1e3
+                  << std::setw(12) << percentile(latencies, 0.99) * 1e3
+                  << std::setw(12) << percentile(latencies, 1.) * 1e3
+                  << std::setw(10) << late << std::setw(10) << dropped
+                  << std::setw(10) << skipped << std::setw(10) << errors << std::defaultfloat << std::endl;
+
+        if (++step < steps.size())
+        {
+            start_step();
+            return;
+        }
+
+        // The hub keeps its loop running, so leave from here.
+        std::exit(0);
+    }
+
+    uWS::Hub &hub;
+    int port;
+    double rate;     // frames per second and connection
+    double duration; // of a step in s
+    double deadline; // in s
+    std::size_t window;
+    bool binary;
+
+    std::vector<std::string> messages;
+    std::string hello;
+
+    std::vector<int> steps; // connections of each step
+    std::size_t step = 0;
+    std::deque<Client> clients;
+    std::size_t first = 0; // first client of the step
+    bool sending = false;
+    Clock::time_point step_end;
+
+    std::vector<double> latencies;
+    std::size_t sent = 0, late = 0, skipped = 0, errors = 0;
+};
+
+}
+
+int main(int argc, char **argv)
+{
+    Config config;
+    config.parse(argc, argv);
+
+    Track track;
+    if (!track.load(config.get("track", "lake_track_waypoints.csv")))
+    {
+        std::cerr << "Failed to load the track" << std::endl;
+        return -1;
+    }
+
+    auto frames = config.has("data") ? load_frames(track, config.get("data", ""))
+                  : make_frames(track, config.get("frames", 500), config.get("speed", 50.));
+    if (frames.empty())
+    {
+        std::cerr << "No frames" << std::endl;
+        return -1;
+    }
+
+    uWS::Hub h;
+    LoadTest test(h, config, frames);
+
+    h.onConnection([&test](uWS::WebSocket<uWS::CLIENT> ws, uWS::HttpRequest req) {
+                       test.connected(ws);
+                   });
+
+    h.onMessage([&test](uWS::WebSocket<uWS::CLIENT> ws, char *data, size_t length, uWS::OpCode opCode) {
+                    test.received(ws, data, length, opCode);
+                });
+
+    h.onDisconnection([](uWS::WebSocket<uWS::CLIENT> ws, int code, char *message, size_t length) {
+                          static_cast<Client *>(ws.getUserData())->open = false;
+                      });
+
+    h.onError([&test](void *user) {
+                  test.failed();
+              });
+
+    uS::Timer *timer = new uS::Timer(h.getLoop());
+    timer->setData(&test);
+    timer->start([](uS::Timer *timer) {
+                     static_cast<LoadTest *>(timer->getData())->tick();
+                 }, 1, 1);
+
+    test.start();
+    h.run();
+}
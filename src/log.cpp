@@ -0,0 +1,113 @@
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include "Config.h"
+#include "RunLog.h"
+
+// Conversion and summary of the run logs of the controller.
+//
+//   mpc_log --import doc/data/fifth.data --output fifth.mpcl
+//   mpc_log --input fifth.mpcl [--print 1]
+//
+// --import converts the text lines printed by mpc into a run log, --input
+// summarizes every column of a run log and measures the scan throughput,
+// --print writes the cycles as text lines for gnuplot instead.
+
+namespace
+{
+
+int print(const RunLogReader &log)
+{
+    std::vector<std::vector<double>> columns(log.columns());
+    std::cout << std::setprecision(6);
+    for (std::size_t chunk = 0; chunk < log.chunks(); ++chunk)
+    {
+        for (std::size_t k = 0; k < columns.size(); ++k)
+        {
+            if (!log.read(chunk, k, columns[k]))
+            {
+                std::cerr << "Corrupt chunk " << chunk << std::endl;
+                return -1;
+            }
+        }
+        for (std::size_t i = 0; i < log.rows(chunk); ++i)
+        {
+            for (std::size_t k = 0; k < columns.size(); ++k)
+                std::cout << (k ? " " : "") << columns[k][i];
+            std::cout << "\n";
+        }
+    }
+    return 0;
+}
+
+int summarize(const RunLogReader &log)
+{
+    std::cout << "cycles " << log.rows() << ", chunks " << log.chunks() << std::endl;
+    std::cout << std::setw(10) << "column" << std::setw(14) << "min" << std::setw(14) << "mean"
+              << std::setw(14) << "max" << std::setw(10) << "NaN" << std::setw(14) << "Mcycles/s" << std::endl;
+
+    for (std::size_t k = 0; k < log.columns(); ++k)
+    {
+        double min = std::numeric_limits<double>::infinity(), max = -min, sum = 0.;
+        std::size_t count = 0, nan = 0;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = log.scan(k, [&](const double *values, std::size_t n) {
+                for (std::size_t i = 0; i < n; ++i)
+                {
+                    if (std::isnan(values[i]))
+                    {
+                        ++nan;
+                        continue;
+                    }
+                    min = std::min(min, values[i]);
+                    max = std::max(max, values[i]);
+                    sum += values[i];
+                    ++count;
+                }
+            });
+        double time = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!ok)
+        {
+            std::cerr << "Corrupt column " << log.name(k) << std::endl;
+            return -1;
+        }
+        std::cout << std::setw(10) << log.name(k) << std::setw(14) << min << std::setw(14)
+                  << (count ? sum / count : 0.) << std::setw(14) << max << std::setw(10) << nan
+                  << std::setw(14) << (time > 0. ? log.rows() / time / 1e6 : 0.) << std::endl;
+    }
+    return 0;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Config config;
+    config.parse(argc, argv);
+
+    if (config.has("import"))
+    {
+        std::string input = config.get("import", "");
+        std::string output = config.get("output", input + ".mpcl");
+        long count = import_run_text(input, output);
+        if (count < 0)
+        {
+            std::cerr << "Failed to convert " << input << std::endl;
+            return -1;
+        }
+        std::cout << output << ": " << count << " cycles" << std::endl;
+        return 0;
+    }
+
+    RunLogReader log;
+    if (!log.open(config.get("input", "run.mpcl")))
+    {
+        std::cerr << "Failed to open the run log" << std::endl;
+        return -1;
+    }
+    return config.get("print", 0) ? print(log) : summarize(log);
+}
@@ -1,202 +1,405 @@
 #include <math.h>
 #include <uWS/uWS.h>
+#include <algorithm>
 #include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
 #include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#endif
 #include "Eigen-3.3/Eigen/Core"
-#include "Eigen-3.3/Eigen/QR"
+#include "Arena.h"
+#include "Config.h"
+#include "Latency.h"
 #include "MPC.h"
+#include "Protocol.h"
+#include "RunLog.h"
+#include "Session.h"
+#include "Telemetry.h"
 #include "json.hpp"
 
-// for convenience
-using json = nlohmann::json;
+// Set by SIGINT and SIGTERM, the event loops poll it and stop.
+static volatile std::sig_atomic_t stop_requested = 0;
 
-// Checks if the SocketIO event has JSON data.
-// If there is data the JSON object in string format will be returned,
-// else the empty string "" will be returned.
-std::string hasData(std::string s)
+// Interval of the polls in ms.
+static const int stop_poll_ms = 100;
+
+// Reply of a connection held back by the actuation delay on a timer of the
+// event loop, so the other connections of the loop are served meanwhile.
+// A connection keeps its timer until it closes.
+struct DelayedReply
 {
-    auto found_null = s.find("null");
-    auto b1 = s.find_first_of("[");
-    auto b2 = s.rfind("}]");
-    if (found_null != std::string::npos)
-    {
-        return std::string();
-    } else if (b1 != std::string::npos && b2 != std::string::npos)
-    {
-        return s.substr(b1, b2 - b1 + 2);
-    }
-    return std::string();
-}
+    explicit DelayedReply(uWS::WebSocket<uWS::SERVER> ws) : ws(ws) {}
+
+    uWS::WebSocket<uWS::SERVER> ws;
+    uWS::OpCode op_code = uWS::OpCode::TEXT;
+    std::chrono::steady_clock::time_point arrival; // of the frame
+    uS::Timer *timer = nullptr;
+    bool pending = false;       // the timer runs
+    std::function<void()> send; // the reply and its latency
+};
 
-// Evaluate a polynomial.
-double polyeval(Eigen::VectorXd coeffs, double x)
+// Pin the calling thread to a CPU, only on Linux.
+static void pin_thread(std::size_t cpu)
 {
-    double result = 0.0;
-    for (int i = 0; i < coeffs.size(); i++)
-    {
-        result += coeffs[i] * pow(x, i);
-    }
-    return result;
+#ifdef __linux__
+    cpu %= std::max(1u, std::thread::hardware_concurrency());
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        std::cerr << "Failed to pin a server thread to CPU " << cpu << std::endl;
+#endif
 }
 
-// Fit a polynomial.
-// Adapted from
-// https://github.com/JuliaMath/Polynomials.jl/blob/master/src/Polynomials.jl#L676-L716
-Eigen::VectorXd polyfit(Eigen::VectorXd xvals, Eigen::VectorXd yvals, int order)
-{
-    assert(xvals.size() == yvals.size());
-    assert(order >= 1 && order <= xvals.size() - 1);
-    Eigen::MatrixXd A(xvals.size(), order + 1);
+int main(int argc, char **argv) {
+    Config config;
+    config.parse(argc, argv);
 
-    for (int i = 0; i < xvals.size(); i++)
+    // Event loops of the server, each on a thread of its own that accepts
+    // connections on the shared port.  The connections, their sessions and
+    // solves stay on the thread that accepted them.
+    std::size_t threads = std::max(0, config.get("server.threads", 1));
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    const bool pin = threads > 1 && config.get("server.pin", 1) != 0;
+    if (threads > 1 && !thread_safe_linear_solver(config))
     {
-        A(i, 0) = 1.0;
+        std::cerr << "Parallel solves need a thread safe --ipopt.linear_solver, e.g. ma27" << std::endl;
+        return -1;
     }
+    // The pipeline workers reserve numbers above the threads, see
+    // reserve_solver_thread.  Pipelines of several sessions solve in
+    // parallel if the linear solver allows it.
+    const bool pipeline = config.get("pipeline", 0) != 0;
+    if (threads > 1 || (pipeline && thread_safe_linear_solver(config)))
+        setup_parallel_solves(threads);
+    if (!check_options(config))
+        return -1;
+
+    // Every connection drives its own vehicle with the controller of its
+    // session, the sessions of each thread are pooled.  The lock guards the
+    // pool list and the latency metrics shared by the threads.  The lines
+    // printed for every frame are single stdio calls, which stdio keeps
+    // whole without this lock.
+    std::vector<SessionPool *> pools(threads, nullptr);
+    std::mutex shared;
 
-    for (int j = 0; j < xvals.size(); j++)
+    // Run log of the cycles, completed once the event loops have stopped,
+    // its lock is only taken if it is open.
+    RunLogWriter run_log;
+    std::mutex log_mutex;
+    if (config.has("log"))
     {
-        for (int i = 0; i < order; i++) {
-            A(j, i + 1) = A(j, i) * xvals(j);
+        if (!run_log.open(config.get("log", "")))
+        {
+            std::cerr << "Failed to open the run log" << std::endl;
+            return -1;
         }
     }
+    std::signal(SIGINT, [](int) { stop_requested = 1; });
+    std::signal(SIGTERM, [](int) { stop_requested = 1; });
 
-    auto Q = A.householderQr();
-    auto result = Q.solve(yvals);
-    return result;
-}
+    // Artificial actuation delay in ms before a reply is sent, load tests
+    // can set it to 0.
+    //
+    // The purpose is to mimic real driving conditions where
+    // the car does actuate the commands instantly.
+    //
+    // Feel free to play around with this value but should be to drive
+    // around the track with 100ms latency.
+    //
+    // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
+    // SUBMITTING.
+    const int sleep_ms = config.get("sleep_ms", 100);
+
+    // Delay from the arrival of a frame to its reply, the compensation of a
+    // session follows its own estimate unless `latency.measure` is 0, the
+    // metrics report the delays of all sessions.  The diagnostics of the
+    // plan are printed once the reply is sent.
+    LatencyEstimator estimator(config);
+    double compensation = config.get("latency", 0.1);
+    const bool measure = config.get("latency.measure", 1) != 0;
+    const bool diagnostics = config.get("diagnostics", 1) != 0;
+    auto replied = [&shared, &estimator, &compensation, measure, diagnostics](Session &session,
+                                                                              std::chrono::steady_clock::time_point arrival) {
+        const double delay = std::chrono::duration<double>(std::chrono::steady_clock::now() - arrival).count();
+        session.estimator.add(delay);
+        ++session.frames;
+        if (measure)
+            session.mpc.set_latency(session.estimator.value());
+
+        {
+            std::lock_guard<std::mutex> lock(shared);
+            estimator.add(delay);
+            compensation = session.mpc.latency;
+        }
+        const Plan &plan = session.plan;
+        if (diagnostics && plan.ok())
+            std::fprintf(stderr, "Cost %g %g %g curvature %g vs %g time %g\n", plan.cost, plan.inputs[0][0],
+                         plan.inputs[1][0], plan.curvature, plan.trajectory_curvature(), plan.solve_time);
+    };
+
+    // Solve the telemetry of the session into its reply.
+    auto control = [&run_log, &log_mutex](Session &session) {
+        const Telemetry &telemetry = session.telemetry;
+        Steer &steer = session.steer;
+        Plan &plan = session.plan;
+        const auto &pipeline = session.pipeline;
+
+        CarFrame &frame = session.frame;
+        to_car_frame(telemetry, frame);
+        const auto &x_vals = frame.x_vals;
+
+        if (pipeline)
+            pipeline->Solve(telemetry, frame, plan);
+        else
+            session.mpc.Solve(frame.state, frame.coeffs, x_vals.front(), x_vals.back(), plan);
+        double steer_value = plan.delta;
+        double throttle_value = plan.a;
+
+        // NOTE: Remember to divide by deg2rad(25) before you send the steering value back.
+        // Otherwise the values will be in between [-deg2rad(25), deg2rad(25] instead of [-1, 1].
+        steer.steering_angle = -steer_value / deg2rad(25);
+        steer.throttle = throttle_value;
+        steer.mpc_x.assign(plan.x(), plan.x() + plan.N);
+        steer.mpc_y.assign(plan.y(), plan.y() + plan.N);
+        // The waypoints are not needed after the solve, the frame takes the
+        // vectors of the last reply instead of copying.
+        steer.next_x.swap(frame.x_vals);
+        steer.next_y.swap(frame.y_vals);
+
+        std::printf("%g %g %g %g %g %g %g %g\n", telemetry.x, telemetry.y, telemetry.psi, frame.state[3], plan.cost,
+                    steer_value, throttle_value, plan.ref_v);
+        if (run_log.is_open())
+        {
+            const double row[run_columns] = {telemetry.x, telemetry.y, telemetry.psi, frame.state[3], plan.cost,
+                                             steer_value, throttle_value, plan.ref_v};
+            std::lock_guard<std::mutex> lock(log_mutex);
+            if (!run_log.add(row))
+                std::fprintf(stderr, "Failed to write the run log\n");
+        }
+
+        // The next frame is solved while the actuations are delayed.
+        if (pipeline)
+            pipeline->speculate(telemetry, plan);
+    };
+
+    // Run the event loop of a server thread, listening is reported once the
+    // port is open or failed to open.
+    const int port = config.get("port", 4567);
+    auto serve = [&](std::size_t reactor, std::promise<bool> &listening) {
+        if (pin)
+            pin_thread(reactor);
+        set_solver_thread(reactor);
+
+        // The hub and the sessions are created on the thread, a hub of its
+        // own has an event loop of its own.
+        uWS::Hub h;
+        SessionPool sessions(config);
+        {
+            std::lock_guard<std::mutex> lock(shared);
+            pools[reactor] = &sessions;
+        }
 
-int main() {
-    uWS::Hub h;
-
-    // MPC is initialized here!
-    MPC mpc;
-
-    h.onMessage([&mpc](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
-                       uWS::OpCode opCode) {
-                    // "42" at the start of the message means there's a websocket message event.
-                    // The 4 signifies a websocket message
-                    // The 2 signifies a websocket event
-                    std::string sdata = std::string(data).substr(0, length);
-                    if (sdata.size() > 2 && sdata[0] == '4' && sdata[1] == '2')
-                    {
-                        std::string s = hasData(sdata);
-                        if (s != "")
+        // Send the reply in the message of the session after the actuation
+        // delay.  A frame that arrives while the reply to the previous one
+        // is held back is dropped.
+        std::unordered_map<Session *, DelayedReply> delayed;
+        auto reply = [&h, &delayed, &replied, sleep_ms](uWS::WebSocket<uWS::SERVER> ws, Session &session,
+                                                        uWS::OpCode op_code, std::chrono::steady_clock::time_point arrival) {
+            if (sleep_ms <= 0)
+            {
+                ws.send(session.message.data(), session.message.length(), op_code);
+                replied(session, arrival);
+                return;
+            }
+
+            auto it = delayed.find(&session);
+            if (it == delayed.end())
+            {
+                it = delayed.emplace(&session, DelayedReply(ws)).first;
+                DelayedReply &entry = it->second;
+                entry.timer = new uS::Timer(h.getLoop());
+                entry.timer->setData(&entry);
+                entry.send = [&replied, &entry, &session] {
+                    entry.pending = false;
+                    entry.ws.send(session.message.data(), session.message.length(), entry.op_code);
+                    replied(session, entry.arrival);
+                };
+            }
+            DelayedReply &entry = it->second;
+            entry.op_code = op_code;
+            entry.arrival = arrival;
+            entry.pending = true;
+            entry.timer->start([](uS::Timer *timer) { static_cast<DelayedReply *>(timer->getData())->send(); },
+                               sleep_ms, 0);
+        };
+        auto busy = [&delayed](Session *session) {
+            auto it = delayed.find(session);
+            return it != delayed.end() && it->second.pending;
+        };
+
+        h.onMessage([&control, &reply, &busy](uWS::WebSocket<uWS::SERVER> ws, char *data, size_t length,
+                           uWS::OpCode opCode) {
+                        const auto arrival = std::chrono::steady_clock::now();
+                        auto session = static_cast<Session *>(ws.getUserData());
+                        auto &message = session->message;
+
+                        if (opCode == uWS::OpCode::BINARY)
                         {
-                            auto j = json::parse(s);
-                            std::string event = j[0].get<std::string>();
-                            if (event == "telemetry")
+                            std::uint16_t version;
+                            switch (message_type(data, length, version))
                             {
-                                // j[1] is the data JSON object
-                                std::vector<double> ptsx = j[1]["ptsx"];
-                                std::vector<double> ptsy = j[1]["ptsy"];
-                                double px = j[1]["x"];
-                                double py = j[1]["y"];
-                                double psi = j[1]["psi"]; // in rad
-                                double v = static_cast<double>(j[1]["speed"]) * 1609.34 / 3600.; // in m/s
-
-                                std::vector<double> x_vals(ptsx.size()), y_vals(ptsy.size());
-                                Eigen::VectorXd vx_vals(ptsx.size()), vy_vals(ptsy.size());
-                                for (std::size_t i = 0; i < ptsx.size(); ++i)
+                            case MessageType::hello:
+                                session->binary = version == protocol_version;
+                                encode_hello(message);
+                                ws.send(message.data(), message.length(), uWS::OpCode::BINARY);
+                                break;
+
+                            case MessageType::telemetry:
+                                if (!busy(session) && session->binary && decode_telemetry(data, length, session->telemetry))
                                 {
-                                    double x = ptsx[i] - px, y = ptsy[i] - py;
-                                    vx_vals[i] = x_vals[i] =  x * std::cos(-psi) - y * std::sin(-psi);
-                                    vy_vals[i] = y_vals[i] =  x * std::sin(-psi) + y * std::cos(-psi);
+                                    control(*session);
+                                    encode_steer(session->steer, message);
+                                    reply(ws, *session, uWS::OpCode::BINARY, arrival);
                                 }
+                                break;
 
-                                auto coeffs = polyfit(vx_vals, vy_vals, 3);
-                                auto cte = polyeval(coeffs, 0.);
-                                auto epsi = -atanf(coeffs[1]);
-
-                                // state in car coordniates
-                                Eigen::VectorXd state(6);
-                                state << 0., 0., 0., v, cte, epsi;
-
-                                double steer_value;
-                                double throttle_value;
-                                double cost;
-                                double ref_v;
-                                std::vector<double> mpc_x_vals, mpc_y_vals;
-
-                                std::tie(steer_value, throttle_value, mpc_x_vals, mpc_y_vals, cost, ref_v) =
-                                    mpc.Solve(state, coeffs, x_vals.front(), x_vals.back());
-
-                                json msgJson;
-                                // NOTE: Remember to divide by deg2rad(25) before you send the steering value back.
-                                // Otherwise the values will be in between [-deg2rad(25), deg2rad(25] instead of [-1, 1].
-                                msgJson["steering_angle"] = -steer_value / deg2rad(25);
-                                msgJson["throttle"] = throttle_value;
-
-                                //Display the MPC predicted trajectory
-                                //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-                                // the points in the simulator are connected by a Green line
-
-                                msgJson["mpc_x"] = mpc_x_vals;
-                                msgJson["mpc_y"] = mpc_y_vals;
-
-                                //Display the waypoints/reference line
-                                //.. add (x,y) points to list here, points are in reference to the vehicle's coordinate system
-                                // the points in the simulator are connected by a Yellow line
-                                msgJson["next_x"] = x_vals;
-                                msgJson["next_y"] = y_vals;
-
-                                std::cout << px << " " << py << " " << psi << " " << v << " "  << cost
-                                          << " " << steer_value << " " << throttle_value << " " << ref_v
-                                          << std::endl;
-
-                                auto msg = "42[\"steer\"," + msgJson.dump() + "]";
-                                //std::cout << msg << std::endl;
-                                // Latency
-                                // The purpose is to mimic real driving conditions where
-                                // the car does actuate the commands instantly.
-                                //
-                                // Feel free to play around with this value but should be to drive
-                                // around the track with 100ms latency.
-                                //
-                                // NOTE: REMEMBER TO SET THIS TO 100 MILLISECONDS BEFORE
-                                // SUBMITTING.
-                                std::this_thread::sleep_for(std::chrono::milliseconds(100));
-                                ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+                            default:
+                                break;
                             }
-                        } else {
-                            // Manual driving
-                            std::string msg = "42[\"manual\",{}]";
-                            ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+                            return;
                         }
-                    }
-                });
-
-    // We don't need this since we're not using HTTP but if it's removed the
-    // program
-    // doesn't compile :-(
-    h.onHttpRequest([](uWS::HttpResponse *res, uWS::HttpRequest req, char *data,
-                       size_t, size_t) {
-                        const std::string s = "<h1>Hello world!</h1>";
-                        if (req.getUrl().valueLength == 1) {
-                            res->end(s.data(), s.length());
-                        } else {
-                            // i guess this should be done more gracefully?
-                            res->end(nullptr, 0);
+
+                        // "42" at the start of the message means there's a websocket message event.
+                        // The 4 signifies a websocket message
+                        // The 2 signifies a websocket event
+                        if (length > 2 && data[0] == '4' && data[1] == '2' && !busy(session))
+                        {
+                            // The reply lives in the arena of the session until
+                            // the end of the frame.
+                            Arena::Frame arena_frame(session->arena);
+
+                            const char *begin, *end;
+                            if (event_data(data, length, begin, end))
+                            {
+                                if (read_telemetry(begin, end, session->telemetry, session->buffer))
+                                {
+                                    control(*session);
+                                    format_steer(session->steer, message);
+                                    //std::cout << message << std::endl;
+                                    reply(ws, *session, uWS::OpCode::TEXT, arrival);
+                                }
+                            } else {
+                                // Manual driving
+                                std::string msg = "42[\"manual\",{}]";
+                                ws.send(msg.data(), msg.length(), uWS::OpCode::TEXT);
+                            }
                         }
                     });
 
-    h.onConnection([&h](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
-                       std::cerr << "Connected!!!" << std::endl;
-                   });
+        // GET /metrics reports the measured latency and the sessions.
+        h.onHttpRequest([&shared, &pools, &estimator, &compensation](uWS::HttpResponse *res, uWS::HttpRequest req, char *data,
+                           size_t, size_t) {
+                            const std::string s = "<h1>Hello world!</h1>";
+                            const auto url = req.getUrl();
+                            if (url.valueLength == 1) {
+                                res->end(s.data(), s.length());
+                            } else if (std::string(url.value, url.valueLength) == "/metrics") {
+                                std::string metrics;
+                                std::lock_guard<std::mutex> lock(shared);
+                                format_metrics(estimator, compensation, metrics);
+                                format_metrics(pools, metrics);
+                                res->end(metrics.data(), metrics.length());
+                            } else {
+                                // i guess this should be done more gracefully?
+                                res->end(nullptr, 0);
+                            }
+                        });
+
+        h.onConnection([&sessions](uWS::WebSocket<uWS::SERVER> ws, uWS::HttpRequest req) {
+                           ws.setUserData(sessions.acquire());
+                           std::cerr << "Connected!!!" << std::endl;
+                       });
+
+        h.onDisconnection([&sessions, &delayed](uWS::WebSocket<uWS::SERVER> ws, int code,
+                               char *message, size_t length) {
+                              auto session = static_cast<Session *>(ws.getUserData());
+                              auto it = delayed.find(session);
+                              if (it != delayed.end())
+                              {
+                                  it->second.timer->stop();
+                                  it->second.timer->close();
+                                  delayed.erase(it);
+                              }
+                              sessions.release(session);
+                              ws.setUserData(nullptr);
+                              ws.close();
+                              std::cerr << "Disconnected" << std::endl;
+                          });
+
+        // The threads share the port with SO_REUSEPORT, the kernel spreads
+        // the new connections across them.
+        const bool ok = h.listen(port, nullptr, threads > 1 ? uS::REUSE_PORT : 0);
+        listening.set_value(ok);
+        if (ok)
+        {
+            // Once a stop is requested, closing the sockets and the timer
+            // ends the event loop.
+            auto timer = new uS::Timer(h.getLoop());
+            timer->setData(&h);
+            timer->start([](uS::Timer *timer) {
+                             if (!stop_requested)
+                                 return;
+                             static_cast<uWS::Hub *>(timer->getData())->getDefaultGroup<uWS::SERVER>().close();
+                             timer->stop();
+                             timer->close();
+                         }, stop_poll_ms, stop_poll_ms);
+            h.run();
+        }
+
+        std::lock_guard<std::mutex> lock(shared);
+        pools[reactor] = nullptr;
+    };
 
-    h.onDisconnection([&h](uWS::WebSocket<uWS::SERVER> ws, int code,
-                           char *message, size_t length) {
-                          ws.close();
-                          std::cerr << "Disconnected" << std::endl;
-                      });
+    std::vector<std::promise<bool>> listening(threads);
+    std::vector<std::thread> reactors;
+    for (std::size_t reactor = 0; reactor < threads; ++reactor)
+        reactors.emplace_back(serve, reactor, std::ref(listening[reactor]));
 
-    int port = 4567;
-    if (h.listen(port)) {
-        std::cout << "Listening to port " << port << std::endl;
-    } else {
+    bool listened = true;
+    for (auto &promise : listening)
+        listened &= promise.get_future().get();
+    if (listened)
+    {
+        std::lock_guard<std::mutex> lock(shared);
+        std::cout << "Listening to port " << port;
+        if (threads > 1)
+            std::cout << " on " << threads << " threads";
+        std::cout << std::endl;
+    }
+    else
+    {
         std::cerr << "Failed to listen to port" << std::endl;
+        stop_requested = 1;
+    }
+
+    for (auto &reactor : reactors)
+        reactor.join();
+    if (!run_log.close())
+    {
+        std::cerr << "Failed to write the run log" << std::endl;
         return -1;
     }
-    h.run();
+    return listened ? 0 : -1;
 }
@@ -0,0 +1,102 @@
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Config.h"
+#include "MPC.h"
+#include "Simulator.h"
+#include "Track.h"
+
+// Closed loop run of the controller on a simulated vehicle, without the
+// simulator and websockets, to catch regressions of the controller.
+//
+//   mpc_sim [--track lake_track_waypoints.csv] [--sim.latency 0.1] [--sim.noise_position 0.1]
+//           [--latency.mode "interpolate;predict"] [--model "kinematic;dynamic"]
+//           [--expect.lap_time 60] [--expect.max_cte 1.5] [--expect.solve_p95 20]
+//
+// All controller options apply, see Simulator.h for the `sim.*` options.
+// The options below take a semicolon separated list of values and every
+// combination of them drives a lap, e.g. to compare the latency
+// compensations at the same solve cost.  The exit status is nonzero if a
+// lap was not completed or a result exceeds its `expect.*` limit, lap time
+// in s, CTE in m and solve times in ms.
+
+namespace
+{
+
+// Options that can be varied between runs.
+const std::vector<std::string> axes = {"latency.mode", "latency", "sim.latency", "pipeline", "model", "integrator",
+                                       "blocks", "dt"};
+
+double percentile(std::vector<double> values, double p)
+{
+    if (values.empty())
+        return 0.;
+    std::sort(values.begin(), values.end());
+    return values[static_cast<std::size_t>(p * (values.size() - 1))];
+}
+
+// Compare a result with its limit, if one is given.
+bool check(const Config &config, const std::string &label, const char *key, double value)
+{
+    if (!config.has(key))
+        return true;
+    double limit = config.get(key, 0.);
+    if (value <= limit)
+        return true;
+    std::cerr << label << key << " exceeded: " << value << " > " << limit << std::endl;
+    return false;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Config config;
+    config.parse(argc, argv);
+
+    Track track;
+    if (!track.load(config.get("track", "lake_track_waypoints.csv")))
+    {
+        std::cerr << "Failed to load the track" << std::endl;
+        return -1;
+    }
+
+    std::vector<std::string> labels;
+    auto configs = make_configs(config, axes, labels);
+    for (const auto &options : configs)
+    {
+        if (!check_options(options))
+            return -1;
+    }
+
+    std::cout << std::setw(40) << std::left << "options" << std::right
+              << std::setw(6) << "lap" << std::setw(10) << "time s" << std::setw(10) << "max cte"
+              << std::setw(10) << "mean cte" << std::setw(10) << "v m/s" << std::setw(8) << "cycles"
+              << std::setw(8) << "fails" << std::setw(8) << "spec" << std::setw(10) << "p50 ms" << std::setw(10) << "p95 ms"
+              << std::setw(10) << "p99 ms" << std::setw(10) << "max ms" << std::endl;
+
+    bool ok = true;
+    for (std::size_t i = 0; i < configs.size(); ++i)
+    {
+        auto result = simulate(track, configs[i]);
+        const auto &time = result.solve_time;
+
+        std::cout << std::setw(40) << std::left << labels[i] << std::right << std::fixed << std::setprecision(3)
+                  << std::setw(6) << (result.completed ? "yes" : "no")
+                  << std::setw(10) << result.lap_time << std::setw(10) << result.max_cte
+                  << std::setw(10) << result.mean_cte << std::setw(10) << result.mean_speed
+                  << std::setw(8) << result.cycles << std::setw(8) << result.failures
+                  << std::setw(8) << result.accepted
+                  << std::setw(10) << percentile(time, 0.5) * 1e3 << std::setw(10) << percentile(time, 0.95) * 1e3
+                  << std::setw(10) << percentile(time, 0.99) * 1e3 << std::setw(10) << percentile(time, 1.) * 1e3
+                  << std::defaultfloat << std::endl;
+
+        ok = result.completed && ok;
+        ok = check(config, labels[i], "expect.lap_time", result.lap_time) && ok;
+        ok = check(config, labels[i], "expect.max_cte", result.max_cte) && ok;
+        ok = check(config, labels[i], "expect.solve_p95", percentile(time, 0.95) * 1e3) && ok;
+    }
+    return ok ? 0 : 1;
+}
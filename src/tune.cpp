@@ -0,0 +1,301 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Config.h"
+#include "MPC.h"
+#include "Simulator.h"
+#include "ThreadPool.h"
+#include "Track.h"
+
+// Tuning of the cost weights and the reference speed profile with mpc_sim
+// laps.
+//
+//   mpc_tune [--config conf/default.conf] [--tune.keys "cost.cte;cost.epsi;..."]
+//            [--tune.max_cte 2] [--tune.iterations 50] [--tune.step 0.5]
+//            [--threads 1] [--output tuned.conf] [simulator options]
+//
+// Nelder-Mead minimizes the lap time over the logarithms of the values of
+// the keys, starting from their configured values, conf/default.conf by
+// default.  A lap over --tune.max_cte m costs 100 s per m in excess and an
+// unfinished lap costs the maximum time plus 1 s per missing m.  The
+// vertices of the first simplex, the candidates of a step (reflection,
+// expansion and both contractions) and the vertices of a shrink are
+// simulated in parallel on --threads workers, 1 by default and 0 for all
+// hardware threads, and laps are cached by the hash of their values, so a
+// repeated candidate costs nothing.  The best values are printed in the
+// configuration file format and written to --output.  More than one worker
+// needs a thread safe linear solver in Ipopt, see thread_safe_linear_solver,
+// and the speculative solves of `pipeline` laps run on solver threads of
+// their own, see reserve_solver_thread.
+
+namespace
+{
+
+const char *const default_keys = "cost.cte;cost.epsi;cost.v;cost.delta;cost.a;cost.delta_rate;"
+                                 "speed.max;speed.span;speed.gain;speed.curvature";
+
+struct Evaluation
+{
+    double score = 0.;
+    SimResult result;
+};
+
+class Tuner
+{
+public:
+    Tuner(const Track &track, const Config &config, const std::vector<std::string> &keys)
+        : track(track), config(config), keys(keys), pool(std::max(0, config.get("threads", 1))),
+          max_cte(config.get("tune.max_cte", 2.)), max_time(config.get("sim.max_time", 300.))
+    {
+        if (pool.size() > 1)
+            setup_parallel_solves(pool.size());
+    }
+
+    // More than one worker needs a thread safe linear solver.
+    bool usable() const { return pool.size() == 1 || thread_safe_linear_solver(config); }
+
+    // Values of the keys at x, as the simulations read them.
+    std::vector<std::string> values(const std::vector<double> &x) const
+    {
+        std::vector<std::string> result;
+        char value[32];
+        for (double v : x)
+        {
+            std::snprintf(value, sizeof(value), "%.6g", std::exp(v));
+            result.push_back(value);
+        }
+        return result;
+    }
+
+    // Scores of the points, simulated in parallel unless cached.
+    std::vector<double> evaluate(const std::vector<std::vector<double>> &points)
+    {
+        std::vector<std::uint64_t> hashes;
+        std::vector<std::size_t> pending;
+        for (const auto &x : points)
+        {
+            hashes.push_back(hash(values(x)));
+            if (cache.count(hashes.back()) || std::count(hashes.begin(), hashes.end() - 1, hashes.back()))
+            {
+                ++hits;
+                continue;
+            }
+            pending.push_back(hashes.size() - 1);
+        }
+
+        std::vector<Evaluation> evaluations(pending.size());
+        pool.run(pending.size(), [&](std::size_t i, std::size_t worker) {
+                set_solver_thread(worker);
+                Config run = config;
+                auto v = values(points[pending[i]]);
+                for (std::size_t k = 0; k < keys.size(); ++k)
+                    run.set(keys[k], v[k]);
+                evaluations[i].result = simulate(track, run);
+                evaluations[i].score = score(evaluations[i].result);
+            });
+        for (std::size_t i = 0; i < pending.size(); ++i)
+            cache[hashes[pending[i]]] = evaluations[i];
+        simulations += pending.size();
+
+        std::vector<double> scores;
+        for (auto h : hashes)
+            scores.push_back(cache[h].score);
+        return scores;
+    }
+
+    const Evaluation &evaluation(const std::vector<double> &x) { return cache[hash(values(x))]; }
+
+    std::size_t simulations = 0, hits = 0;
+
+private:
+    double score(const SimResult &result) const
+    {
+        if (!result.completed)
+            return max_time + std::max(0., track.length() - result.progress);
+        return result.lap_time + 100. * std::max(0., result.max_cte - max_cte);
+    }
+
+    // FNV-1a of the values.
+    static std::uint64_t hash(const std::vector<std::string> &values)
+    {
+        std::uint64_t h = 14695981039346656037ull;
+        for (const auto &value : values)
+        {
+            for (char c : value + ";")
+            {
+                h ^= static_cast<unsigned char>(c);
+                h *= 1099511628211ull;
+            }
+        }
+        return h;
+    }
+
+    const Track &track;
+    const Config &config;
+    const std::vector<std::string> &keys;
+    ThreadPool pool;
+    double max_cte, max_time;
+    std::unordered_map<std::uint64_t, Evaluation> cache;
+};
+
+std::vector<double> combine(const std::vector<double> &a, const std::vector<double> &b, double t)
+{
+    std::vector<double> x(a.size());
+    for (std::size_t k = 0; k < a.size(); ++k)
+        x[k] = a[k] + t * (b[k] - a[k]);
+    return x;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Config config;
+    config.parse(argc, argv);
+    if (!config.has("config"))
+        config.load("conf/default.conf");
+
+    Track track;
+    if (!track.load(config.get("track", "lake_track_waypoints.csv")))
+    {
+        std::cerr << "Failed to load the track" << std::endl;
+        return -1;
+    }
+
+    auto keys = split(config.get("tune.keys", default_keys), ';');
+    std::vector<double> start;
+    for (const auto &key : keys)
+    {
+        double value = config.get(key, 0.);
+        if (!(value > 0.))
+        {
+            std::cerr << "Tuned values must be positive: " << key << std::endl;
+            return -1;
+        }
+        start.push_back(std::log(value));
+    }
+
+    Tuner tuner(track, config, keys);
+    if (!tuner.usable())
+    {
+        std::cerr << "Parallel solves need a thread safe --ipopt.linear_solver, e.g. ma27" << std::endl;
+        return -1;
+    }
+    if (!check_options(config))
+        return -1;
+    const double step = config.get("tune.step", 0.5);
+    const int iterations = config.get("tune.iterations", 50);
+    const std::size_t n = keys.size();
+
+    // Simplex around the start, a step along every axis.
+    std::vector<std::vector<double>> simplex(1, start);
+    for (std::size_t k = 0; k < n; ++k)
+    {
+        simplex.push_back(start);
+        simplex.back()[k] += step;
+    }
+    auto scores = tuner.evaluate(simplex);
+
+    std::cout << std::setw(6) << "iter" << std::setw(10) << "step" << std::setw(12) << "score"
+              << std::setw(10) << "lap s" << std::setw(10) << "max cte" << std::setw(8) << "sims"
+              << std::setw(8) << "cached" << std::endl;
+
+    for (int iteration = 0; iteration < iterations; ++iteration)
+    {
+        std::vector<std::size_t> order(n + 1);
+        for (std::size_t i = 0; i <= n; ++i)
+            order[i] = i;
+        std::sort(order.begin(), order.end(), [&scores](std::size_t a, std::size_t b) { return scores[a] < scores[b]; });
+        std::vector<std::vector<double>> sorted;
+        std::vector<double> sorted_scores;
+        for (auto i : order)
+        {
+            sorted.push_back(simplex[i]);
+            sorted_scores.push_back(scores[i]);
+        }
+        simplex.swap(sorted);
+        scores.swap(sorted_scores);
+
+        std::vector<double> centroid(n, 0.);
+        for (std::size_t i = 0; i < n; ++i)
+        {
+            for (std::size_t k = 0; k < n; ++k)
+                centroid[k] += simplex[i][k] / n;
+        }
+
+        // Reflection, expansion, outside and inside contraction at once.
+        const auto &worst = simplex[n];
+        std::vector<std::vector<double>> candidates = {combine(centroid, worst, -1.), combine(centroid, worst, -2.),
+                                                       combine(centroid, worst, -0.5), combine(centroid, worst, 0.5)};
+        auto f = tuner.evaluate(candidates);
+
+        const char *action;
+        int accept = -1;
+        if (f[0] < scores[0])
+        {
+            accept = f[1] < f[0] ? 1 : 0;
+            action = accept ? "expand" : "reflect";
+        }
+        else if (f[0] < scores[n - 1])
+        {
+            accept = 0;
+            action = "reflect";
+        }
+        else if (f[0] < scores[n])
+        {
+            accept = f[2] <= f[0] ? 2 : -1;
+            action = "contract";
+        }
+        else
+        {
+            accept = f[3] < scores[n] ? 3 : -1;
+            action = "contract";
+        }
+
+        if (accept >= 0)
+        {
+            simplex[n] = candidates[accept];
+            scores[n] = f[accept];
+        }
+        else
+        {
+            action = "shrink";
+            std::vector<std::vector<double>> shrunk;
+            for (std::size_t i = 1; i <= n; ++i)
+                shrunk.push_back(combine(simplex[0], simplex[i], 0.5));
+            auto g = tuner.evaluate(shrunk);
+            for (std::size_t i = 1; i <= n; ++i)
+            {
+                simplex[i] = shrunk[i - 1];
+                scores[i] = g[i - 1];
+            }
+        }
+
+        auto best = std::min_element(scores.begin(), scores.end()) - scores.begin();
+        const auto &result = tuner.evaluation(simplex[best]).result;
+        std::cout << std::setw(6) << iteration << std::setw(10) << action << std::fixed << std::setprecision(3)
+                  << std::setw(12) << scores[best] << std::setw(10) << result.lap_time << std::setw(10)
+                  << result.max_cte << std::setw(8) << tuner.simulations << std::setw(8) << tuner.hits
+                  << std::defaultfloat << std::endl;
+    }
+
+    auto best = std::min_element(scores.begin(), scores.end()) - scores.begin();
+    auto values = tuner.values(simplex[best]);
+    std::ofstream output;
+    if (config.has("output"))
+        output.open(config.get("output", ""));
+    for (std::size_t k = 0; k < n; ++k)
+    {
+        std::cout << std::setw(20) << std::left << keys[k] << values[k] << std::right << std::endl;
+        if (output)
+            output << std::setw(20) << std::left << keys[k] << values[k] << "\n";
+    }
+    return 0;
+}